@@ -0,0 +1,35 @@
+#ifndef _HECTO_CODEC_H
+#define _HECTO_CODEC_H
+
+// Compressed files are decompressed on open and compressed again on save by external programs,
+// which read from stdin and write to stdout
+struct editorCodec {
+	char *name;
+	char *extension;
+	char **decompress;
+	char **compress;
+};
+
+
+char *Gzip_decompress[] = { "gzip", "-dc", NULL };
+char *Gzip_compress[] = { "gzip", "-c", NULL };
+
+char *Zstd_decompress[] = { "zstd", "-dcq", NULL };
+char *Zstd_compress[] = { "zstd", "-cq", NULL };
+
+char *Xz_decompress[] = { "xz", "-dc", NULL };
+char *Xz_compress[] = { "xz", "-c", NULL };
+
+
+//{ database of codecs
+struct editorCodec CODECDB[] = {
+	{ "gzip", ".gz", Gzip_decompress, Gzip_compress },
+	{ "zstd", ".zst", Zstd_decompress, Zstd_compress },
+	{ "xz", ".xz", Xz_decompress, Xz_compress }
+};
+
+//}
+
+#define CODECDB_ENTRIES (sizeof(CODECDB) / sizeof(CODECDB[0]))
+
+#endif
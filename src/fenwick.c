@@ -0,0 +1,60 @@
+#include "fenwick.h"
+
+#include <stdlib.h>
+
+// Build tree of n elements in O(n), value(i) gives the i-th element
+void fenwickBuild(struct fenwick *f, int n, long long (*value)(int i)) {
+	f->tree = realloc(f->tree, sizeof(long long) * (n + 1));
+	f->n = n;
+	f->tree[0] = 0;
+	for (int i = 1; i <= n; i++) f->tree[i] = value(i - 1);
+	for (int i = 1; i <= n; i++) {
+		int parent = i + (i & -i);
+		if (parent <= n) f->tree[parent] += f->tree[i];
+	}
+}
+
+// Add delta to the i-th element
+void fenwickAdd(struct fenwick *f, int i, long long delta) {
+	for (i++; i <= f->n; i += i & -i)
+		f->tree[i] += delta;
+}
+
+// Sum of the first i elements
+long long fenwickSum(struct fenwick *f, int i) {
+	long long sum = 0;
+	if (i > f->n) i = f->n;
+	for (; i > 0; i -= i & -i)
+		sum += f->tree[i];
+	return sum;
+}
+
+// Value of the i-th element
+long long fenwickGet(struct fenwick *f, int i) {
+	long long value = f->tree[i + 1];
+	// subtract sums of the children, they end right below i
+	for (int j = i, stop = (i + 1) - ((i + 1) & -(i + 1)); j > stop; j -= j & -j)
+		value -= f->tree[j];
+	return value;
+}
+
+// Number of leading elements whose sum doesn't exceed target -- for non-negative elements it's
+// the index of the element which contains position target
+int fenwickSearch(struct fenwick *f, long long target) {
+	int pos = 0;
+	int step = 1;
+	while (step * 2 <= f->n) step *= 2;
+	for (; step > 0; step /= 2) {
+		if (pos + step <= f->n && f->tree[pos + step] <= target) {
+			pos += step;
+			target -= f->tree[pos];
+		}
+	}
+	return pos;
+}
+
+void fenwickFree(struct fenwick *f) {
+	free(f->tree);
+	f->tree = NULL;
+	f->n = 0;
+}
@@ -0,0 +1,19 @@
+#ifndef _HECTO_FENWICK_H_
+#define _HECTO_FENWICK_H_
+
+// Fenwick (binary indexed) tree -- keeps prefix sums of an array updatable in O(log n)
+struct fenwick {
+	long long *tree; // 1-based tree of partial sums
+	int n; // number of elements
+};
+
+#define FENWICK_INIT {NULL, 0}
+
+void fenwickBuild(struct fenwick *f, int n, long long (*value)(int i));
+void fenwickAdd(struct fenwick *f, int i, long long delta);
+long long fenwickSum(struct fenwick *f, int i);
+long long fenwickGet(struct fenwick *f, int i);
+int fenwickSearch(struct fenwick *f, long long target);
+void fenwickFree(struct fenwick *f);
+
+#endif
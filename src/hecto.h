@@ -1,45 +1,176 @@
 #ifndef _HECTO_H_
 #define _HECTO_H_
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memmem, memrchr and pipe2
+#endif
+
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <time.h>
 
+#include "fenwick.h"
+#include "hlcache.h"
+#include "journal.h"
+#include "lineindex.h"
+
 #define HECTO_VERSION "0.1.0"
 #define HECTO_TAB_STOP 8
 #define HECTO_NUMLINE 7
 #define HECTO_QUIT_CONFIRM 3 // how many times should the quit button be pressed to confirm unsaved exit
+#define HECTO_LONGLINE 65536 // rows longer than this are rendered only around the visible part
+#define HECTO_CHUNK 4096 // distance between lexer checkpoints in long rows
+#define HECTO_PAGER_SIZE (1LL << 30) // files this big are opened in read-only pager mode
+#define HECTO_PAGER_ROWS 4096 // how many rows of a file are kept in memory in pager mode
+#define HECTO_LOAD_CHUNK (4 << 20) // files are loaded by as many threads as there are chunks this big
+#define HECTO_LOAD_THREADS 16 // the most threads used to load a file
+#define HECTO_CODEC_BLOCK (1 << 20) // most decompressed data appended to rows at once
+#define HECTO_SAVE_BLOCK (1 << 20) // saving reports its progress after writing this much
+#define HECTO_FILTER_ROWS 512 // most rows written to a filter command at once
+#define HECTO_OSC52_MAX 65536 // copied text up to this big is sent to the terminal's clipboard with -y
+#define HECTO_MEM_BUDGET (512 << 20) // caches of inactive buffers are dropped when all buffers take more memory
+#define HECTO_MAX_WATCHES 16 // how many background event sources the main loop can wait on
+#define HECTO_HL_SYNC 200 // how many stale rows above the screen get highlighted to find out its state
+
+struct erowCheckpoint {
+	int cx; // position in row
+	int rx; // rendered position
+	int state; // lexer state at this position
+};
 
 typedef struct erow {
 	int idx; // row's position in file
 	int size; // size of row
+	int saved_size; // size of row when the file was last loaded or saved
 	int rsize; // size of rendered row (including characters taking up more space like Tab)
+	int rwidth; // width of whole rendered row -- rsize only covers the rendered window of long rows
+	int roff; // rendered position at which render starts (non-zero only for long rows)
+	int rcols; // width of render
+	int rutf8; // whether render has characters other than ASCII, so its bytes aren't its columns
 	char *chars; // content of row
 	char *render; // content of row that will be rendered
 	unsigned char *hl; // array acting like a mask for highlights rendering
-	int hl_open_comment; // whether the row is inside a multiline comment
+	int hl_valid; // whether highlight and state of the row are up to date
+	int hl_state; // lexer state the next row starts in -- open comments and strings spanning rows
+	struct erowCheckpoint *ckpt; // lexer checkpoints of long rows, NULL for regular rows
+	int nckpt; // number of checkpoints
+	int ckpt_dirty; // first checkpoint which needs to be recomputed
+	int wrap_h; // number of screen lines the row takes when soft wrapped
 } erow;
 
+// Extra cursor of a buffer, edits are made at all cursors at once
+struct editorCursor {
+	int cx, cy;
+	int primary; // whether it's the cursor at cx & cy, used while all cursors are edited together
+};
+
+// Saving is done by a thread from a snapshot of the rows, so the file can be edited in the meantime.
+// Progress is reported through a pipe watched by the main loop.
+struct editorSave {
+	char *buf; // snapshot of the rows
+	size_t len;
+	char *filename;
+	struct editorCodec *codec;
+	off_t offset; // where in the file the snapshot is written, -1 when the whole file is replaced
+	int truncate; // whether the file ends with the snapshot
+	int dirty; // edits the snapshot contains
+	char *edits; // journal records of edits made during saving, they aren't in the saved file
+	size_t edits_len;
+	size_t written; // how much of the snapshot was written so far
+	int done; // whether the thread finished
+	int err; // errno of the failed save, 0 if it succeeded
+	int notify[2]; // a byte is written here whenever there's progress to show
+	pthread_t thread;
+	pthread_mutex_t lock;
+};
+
 struct editorConfig {
+	int id; // unique number of the buffer
+	unsigned long used; // when the buffer was last active
+	int window; // id of the window which last showed the buffer
+	int damage_from, damage_to; // rows changed since the screen was last refreshed
+	struct journal *journal; // edits made since the file was saved, NULL when they aren't journaled
+	char *journal_path;
+	struct editorSave *save; // save running in background, NULL if there's none
 	int cx, cy; // cursor x & y position in file (starting from the upperleft corner)
 	int rx; // rendered position of cursor in row -- this position gets displayed on screen
+	struct editorCursor *cursors; // extra cursors ordered by position
+	int ncursors;
+	int sel_mode; // 0 when nothing is selected, 's' for a stream of text, 'l' for rows and 'r' for a rectangle
+	int sel_cx, sel_cy; // where the selection started, it ends at the cursor
 	int rowoff; // row offset -- for vertical scrolling
 	int coloff; // collumn offset -- for horizontal scrolling
 	int screenrows; // height of terminal window
 	int screencols; // width of terminal window
 	int numrows; // number of rows currently in editor memory
 	int show_numline; // boolean to show line numbers on the left side of the screen
+	int softwrap; // boolean to wrap rows wider than the screen instead of scrolling horizontally
+	int wrapoff; // first wrapped line of the top row shown on screen
+	struct fenwick wrap; // screen lines taken by each row when soft wrapped
+	int wrap_dirty; // whether wrap index has to be rebuilt
+	struct fenwick offsets; // size of each row including its newline
+	int offset_dirty; // whether offset index has to be rebuilt
 	erow *row; // array of rows in editor memory
 	char *filename; // name of opened file
 	int dirty; // flag if file was edited since opening
+	int mod_from, mod_to; // rows changed since the file was saved, mod_from is INT_MAX when there are none
+	int mod_rows; // whether rows were inserted or deleted since the file was saved
+	struct stat disk_stat; // the file as it was last loaded or saved
+	int disk_valid; // whether the file on disk matches the rows outside of the changed ones
+	int crlf; // whether carriage returns were stripped from line ends when the file was read
+	int disk_wd; // inotify watch of the file's directory, -1 if the file isn't watched
+	int disk_changed; // 1 once the file was changed by another program, 2 once overwriting it was confirmed
 	char statusmsg[80]; // status message displayed on the bottom of the screen
 	time_t statusmsg_time; // status message timestamp
 	struct editorSyntax *syntax;
+	int follow; // boolean to append data written to the file since opening (tail -f)
+	int follow_fd; // descriptor of the followed file
+	int follow_inotify; // inotify instance watching the followed file
+	int follow_wd; // inotify watch of the followed file itself
+	off_t follow_off; // how much of the followed file was read
+	int follow_open_row; // whether the last row wasn't terminated by a newline yet
+	int readonly; // boolean to disable editing
+	int pager; // boolean -- only a window of rows of the mapped file is loaded
+	const char *pager_data; // mapped file in pager mode
+	off_t pager_size; // size of the mapped file
+	off_t *pager_offs; // offsets of rows in the window, last one is where the window ends
+	struct lineIndex *pager_index; // line offsets of the mapped file built in background
+	int pager_notify[2]; // pipe through which indexing reports its progress
+	int pager_comment; // whether the window starts inside of a multiline comment, -1 if not known yet
+	long long pager_goto; // line to jump to once it gets indexed, -1 for none
+	char *pager_path; // absolute path of the mapped file
+	struct stat pager_stat; // the mapped file as it was when opened
+	char *pager_cache; // file the line index is cached in, NULL if it isn't
+	int pager_cached; // whether the cache file is up to date
+	int cache; // boolean -- line indexes of files in pager mode are cached
+	struct editorCodec *codec; // compression of the file, NULL if it isn't compressed
+	int codec_fd; // pipe from the program decompressing the file, -1 once it's done
+	pid_t codec_pid; // the program decompressing the file
+	int codec_open_row; // whether the last decompressed row wasn't terminated by a newline yet
+	pid_t filter_pid; // command the rows are being filtered through, 0 if there's none
+	int filter_in, filter_out; // pipes to the command and from it, -1 once closed
+	int filter_start, filter_end; // filtered rows, the output is inserted in front of the end one
+	int filter_eof; // whether the filtered rows go up to the end of file
+	int filter_y, filter_x; // next part of the rows to be written to the command
+	int filter_oy, filter_ox; // where the next part of the output is inserted
+	long long filter_len; // size of the output inserted so far
+	int filter_nl; // whether a newline ending the output so far is held back
 };
 
 #endif
@@ -0,0 +1,108 @@
+#include "hlcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Hash of the text mixed 8 bytes at a time, never 0
+uint64_t hlCacheHash(const void *syntax, const char *text, int len, int state) {
+	uint64_t h = ((uint64_t)(uintptr_t)syntax ^ ((uint64_t)state << 32) ^ len) * 0x9e3779b97f4a7c15ULL;
+	int i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t w;
+		memcpy(&w, &text[i], 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	for (; i < len; i++) h = (h ^ (unsigned char)text[i]) * 0x100000001b3ULL;
+	h ^= h >> 29;
+	return h | 1;
+}
+
+static struct hlCacheEntry *hlCacheSlot(struct hlCache *c, uint64_t hash) {
+	if (!c->slots) {
+		c->slots = calloc(HLCACHE_SLOTS, sizeof(struct hlCacheEntry));
+		c->seen = calloc(HLCACHE_SEEN, sizeof(uint32_t));
+	}
+	return &c->slots[(hash >> 7) & (HLCACHE_SLOTS - 2)];
+}
+
+static size_t hlCacheSize(struct hlCacheEntry *e) {
+	return sizeof(struct hlSpan) * e->nspans + e->len;
+}
+
+static void hlCacheDrop(struct hlCache *c, struct hlCacheEntry *e) {
+	if (!e->hash) return;
+	c->bytes -= hlCacheSize(e);
+	free(e->spans);
+	memset(e, 0, sizeof(*e));
+}
+
+// Fills in highlight and exit state of the row if it's cached, returns whether it was
+int hlCacheGet(struct hlCache *c, uint64_t hash, const void *syntax, const char *text, int len, int state,
+	unsigned char *hl, int *exit) {
+	struct hlCacheEntry *pair = hlCacheSlot(c, hash);
+	for (int k = 0; k < 2; k++) {
+		struct hlCacheEntry *e = &pair[k];
+		if (e->hash != hash || e->syntax != syntax || e->state != state || e->len != len ||
+			memcmp(e->text, text, len)) continue;
+		for (int j = 0; j < e->nspans; j++) {
+			memset(hl, e->spans[j].hl, e->spans[j].len);
+			hl += e->spans[j].len;
+		}
+		*exit = e->exit;
+		e->used = ++c->clock;
+		c->hits++;
+		return 1;
+	}
+	c->misses++;
+	return 0;
+}
+
+// Keeps highlight of the row, unless it's too long or there's no memory left for it
+void hlCachePut(struct hlCache *c, uint64_t hash, const void *syntax, const char *text, int len, int state,
+	const unsigned char *hl, int exit) {
+	if (len > HLCACHE_MAXLEN) return;
+	struct hlCacheEntry *pair = hlCacheSlot(c, hash);
+
+	// rows are kept only once they are seen the second time, so unique ones cost next to nothing
+	uint32_t *seen = &c->seen[hash & (HLCACHE_SEEN - 1)];
+	if (*seen != (uint32_t)(hash >> 32)) {
+		*seen = hash >> 32;
+		return;
+	}
+	struct hlCacheEntry *e = (pair[0].used <= pair[1].used) ? &pair[0] : &pair[1];
+
+	struct hlSpan spans[HLCACHE_MAXLEN];
+	int nspans = 0;
+	for (int i = 0; i < len; ) {
+		int j = i + 1;
+		while (j < len && hl[j] == hl[i]) j++;
+		spans[nspans++] = (struct hlSpan){j - i, hl[i]};
+		i = j;
+	}
+	size_t size = sizeof(struct hlSpan) * nspans + len;
+	if (c->bytes - (e->hash ? hlCacheSize(e) : 0) + size > HLCACHE_BUDGET) return;
+	if (e->hash) c->bytes -= hlCacheSize(e);
+
+	// spans and text share one allocation, reused by the next entry of the slot
+	e->spans = realloc(e->spans, size);
+	memcpy(e->spans, spans, sizeof(struct hlSpan) * nspans);
+	e->text = (char *)&e->spans[nspans];
+	memcpy(e->text, text, len);
+	e->hash = hash;
+	e->syntax = syntax;
+	e->state = state;
+	e->exit = exit;
+	e->len = len;
+	e->nspans = nspans;
+	e->used = ++c->clock;
+	c->bytes += size;
+}
+
+void hlCacheClear(struct hlCache *c) {
+	if (c->slots) {
+		for (int i = 0; i < HLCACHE_SLOTS; i++) hlCacheDrop(c, &c->slots[i]);
+		memset(c->seen, 0, sizeof(uint32_t) * HLCACHE_SEEN);
+	}
+	c->hits = c->misses = 0;
+}
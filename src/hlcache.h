@@ -0,0 +1,48 @@
+#ifndef _HECTO_HLCACHE_H_
+#define _HECTO_HLCACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HLCACHE_SLOTS 4096 // how many highlighted rows are kept, a power of two
+#define HLCACHE_BUDGET (4 << 20) // the most memory taken by highlighted rows
+#define HLCACHE_MAXLEN 1024 // longer rows aren't cached
+#define HLCACHE_SEEN 16384 // how many rows are remembered to have been seen once, a power of two
+
+// Run of characters with the same highlight
+struct hlSpan {
+	unsigned short len;
+	unsigned char hl;
+};
+
+// Highlight of a row lexed from some state
+struct hlCacheEntry {
+	uint64_t hash; // of the text, the syntax and the state, 0 for empty slots
+	const void *syntax;
+	int state; // lexer state the row was entered with
+	int exit; // lexer state the row was left with
+	char *text;
+	int len;
+	struct hlSpan *spans;
+	int nspans;
+	unsigned long used; // when the entry was last looked up
+};
+
+// Highlights of rows by their content, shared by all rows so that repeated ones are lexed only once.
+// Every row has two slots it can be kept in, the one used less recently gets replaced.
+struct hlCache {
+	struct hlCacheEntry *slots;
+	uint32_t *seen; // upper halves of hashes of rows seen once
+	size_t bytes; // memory taken by texts and spans of the entries
+	unsigned long clock;
+	long long hits, misses;
+};
+
+uint64_t hlCacheHash(const void *syntax, const char *text, int len, int state);
+int hlCacheGet(struct hlCache *c, uint64_t hash, const void *syntax, const char *text, int len, int state,
+	unsigned char *hl, int *exit);
+void hlCachePut(struct hlCache *c, uint64_t hash, const void *syntax, const char *text, int len, int state,
+	const unsigned char *hl, int exit);
+void hlCacheClear(struct hlCache *c);
+
+#endif
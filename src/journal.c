@@ -0,0 +1,138 @@
+#include "journal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static long long journalNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void journalWrite(struct journal *j, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t n = pwrite(j->fd, data, len, j->off);
+		if (n <= 0) return; // journal is best effort, the file itself is still saved as usual
+		data += n;
+		len -= n;
+		j->off += n;
+	}
+}
+
+// Writes records as they come and syncs them at most every JOURNAL_SYNC_MS
+static void *journalRun(void *arg) {
+	struct journal *j = arg;
+	char *buf = NULL;
+	size_t cap = 0;
+	int unsynced = 0;
+	long long synced = journalNow();
+	
+	pthread_mutex_lock(&j->lock);
+	while (1) {
+		while (!j->stop && j->len == 0 && !j->reset) {
+			if (!unsynced) {
+				pthread_cond_wait(&j->cond, &j->lock);
+				continue;
+			}
+			long long due = synced + JOURNAL_SYNC_MS;
+			if (journalNow() >= due) break;
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			long long ms = due - journalNow();
+			ts.tv_sec += ms / 1000;
+			ts.tv_nsec += (ms % 1000) * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&j->cond, &j->lock, &ts);
+		}
+		
+		// take the records, so more can be added while they are written
+		char *data = j->buf;
+		size_t len = j->len;
+		size_t data_cap = j->cap;
+		j->buf = buf;
+		j->cap = cap;
+		j->len = 0;
+		buf = data;
+		cap = data_cap;
+		int reset = j->reset;
+		int stop = j->stop;
+		j->reset = 0;
+		pthread_mutex_unlock(&j->lock);
+		
+		if (reset) {
+			if (ftruncate(j->fd, 0) == 0) j->off = 0;
+		}
+		if (len > 0 || reset) {
+			journalWrite(j, data, len);
+			unsynced = 1;
+		}
+		if (unsynced && (stop || journalNow() >= synced + JOURNAL_SYNC_MS)) {
+			fdatasync(j->fd);
+			synced = journalNow();
+			unsynced = 0;
+		}
+		
+		pthread_mutex_lock(&j->lock);
+		if (stop && j->len == 0 && !j->reset) break;
+	}
+	pthread_mutex_unlock(&j->lock);
+	free(buf);
+	return NULL;
+}
+
+// Starts writing records to the descriptor at given offset
+int journalOpen(struct journal *j, int fd, off_t off) {
+	j->fd = fd;
+	j->off = off;
+	j->buf = NULL;
+	j->len = 0;
+	j->cap = 0;
+	j->reset = 0;
+	j->stop = 0;
+	pthread_mutex_init(&j->lock, NULL);
+	pthread_cond_init(&j->cond, NULL);
+	return pthread_create(&j->thread, NULL, journalRun, j);
+}
+
+static void journalPush(struct journal *j, const void *data, size_t len) {
+	if (j->len + len > j->cap) {
+		j->cap = (j->len + len) * 2;
+		j->buf = realloc(j->buf, j->cap);
+	}
+	memcpy(j->buf + j->len, data, len);
+	j->len += len;
+	pthread_cond_signal(&j->cond);
+}
+
+void journalAppend(struct journal *j, const void *data, size_t len) {
+	pthread_mutex_lock(&j->lock);
+	journalPush(j, data, len);
+	pthread_mutex_unlock(&j->lock);
+}
+
+// Empties the journal and starts it again with given data, records not written yet are dropped
+void journalReset(struct journal *j, const void *data, size_t len) {
+	pthread_mutex_lock(&j->lock);
+	j->len = 0;
+	j->reset = 1;
+	journalPush(j, data, len);
+	pthread_mutex_unlock(&j->lock);
+}
+
+// Writes and syncs all records and stops the thread, the descriptor is closed
+void journalClose(struct journal *j) {
+	pthread_mutex_lock(&j->lock);
+	j->stop = 1;
+	pthread_cond_signal(&j->cond);
+	pthread_mutex_unlock(&j->lock);
+	pthread_join(j->thread, NULL);
+	pthread_mutex_destroy(&j->lock);
+	pthread_cond_destroy(&j->cond);
+	free(j->buf);
+	close(j->fd);
+}
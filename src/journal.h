@@ -0,0 +1,28 @@
+#ifndef _HECTO_JOURNAL_H_
+#define _HECTO_JOURNAL_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define JOURNAL_SYNC_MS 200 // records are synced to disk in batches at most this often
+
+// Append-only file written by a background thread, so adding a record only costs a copy to memory
+struct journal {
+	int fd;
+	off_t off; // where the next record goes
+	char *buf; // records waiting to be written
+	size_t len, cap;
+	int reset; // whether the file is truncated before writing buf
+	int stop; // asks the thread to write what's left and finish
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+int journalOpen(struct journal *j, int fd, off_t off);
+void journalAppend(struct journal *j, const void *data, size_t len);
+void journalReset(struct journal *j, const void *data, size_t len);
+void journalClose(struct journal *j);
+
+#endif
@@ -0,0 +1,384 @@
+#include "lineindex.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LINEINDEX_BLOCK (64 << 20) // progress is reported after every block scanned
+
+// Header of a cache file, followed by the path of indexed file, offsets and comments
+struct lineIndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t pathlen;
+	int64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t ino;
+	uint64_t dev;
+	int64_t nlines;
+	int64_t ncomments; // 0 if comments weren't cached
+	char lexer[32]; // name of the syntax comments were found with
+};
+
+static void lineIndexNotify(struct lineIndex *li) {
+	if (li->notify_fd != -1 && write(li->notify_fd, "", 1)) {}
+}
+
+// How many offsets are stored for given number of lines
+static long long lineIndexStrides(long long nlines) {
+	return nlines > 0 ? (nlines - 1) / LINEINDEX_STRIDE + 1 : 1;
+}
+
+static void lineIndexScanLines(struct lineIndex *li) {
+	const char *p = li->data;
+	const char *end = li->data + li->size;
+	const char *next_report = p + LINEINDEX_BLOCK;
+	long long nlines = 0;
+	
+	while (p < end && !li->cancel) {
+		const char *nl = memchr(p, '\n', end - p);
+		p = nl ? nl + 1 : end;
+		nlines++;
+		
+		if (nlines % LINEINDEX_STRIDE == 0 || p >= next_report || p == end) {
+			pthread_mutex_lock(&li->lock);
+			if (nlines % LINEINDEX_STRIDE == 0 && p < end) {
+				long long k = nlines / LINEINDEX_STRIDE;
+				if ((k & (k - 1)) == 0) li->offs = realloc(li->offs, sizeof(off_t) * k * 2);
+				li->offs[k] = p - li->data;
+			}
+			li->nlines = nlines;
+			li->scanned = p - li->data;
+			pthread_mutex_unlock(&li->lock);
+			
+			if (p >= next_report) {
+				next_report = p + LINEINDEX_BLOCK;
+				lineIndexNotify(li);
+			}
+		}
+	}
+	
+	pthread_mutex_lock(&li->lock);
+	li->done = !li->cancel;
+	pthread_mutex_unlock(&li->lock);
+	lineIndexNotify(li);
+}
+
+// Second pass over the file, run once all lines are known, lexing it to find multiline comments
+static void lineIndexScanComments(struct lineIndex *li) {
+	const char *p = li->data;
+	const char *end = li->data + li->size;
+	long long line = 0;
+	int in_comment = 0;
+	
+	pthread_mutex_lock(&li->lock);
+	li->comments = malloc(lineIndexStrides(li->nlines));
+	pthread_mutex_unlock(&li->lock);
+	
+	while (p < end && !li->cancel) {
+		if (line % LINEINDEX_STRIDE == 0) {
+			pthread_mutex_lock(&li->lock);
+			li->comments[line / LINEINDEX_STRIDE] = in_comment;
+			li->ncomments = line / LINEINDEX_STRIDE + 1;
+			pthread_mutex_unlock(&li->lock);
+		}
+		const char *nl = memchr(p, '\n', end - p);
+		size_t len = (nl ? nl : end) - p;
+		in_comment = li->lex(li->syntax, p, len, in_comment);
+		p = nl ? nl + 1 : end;
+		line++;
+	}
+	
+	pthread_mutex_lock(&li->lock);
+	li->comments_done = !li->cancel;
+	pthread_mutex_unlock(&li->lock);
+	lineIndexNotify(li);
+}
+
+static void *lineIndexScan(void *arg) {
+	struct lineIndex *li = arg;
+	if (!li->done) lineIndexScanLines(li);
+	if (li->lex && !li->comments_done && !li->cancel) lineIndexScanComments(li);
+	return NULL;
+}
+
+void lineIndexInit(struct lineIndex *li, const char *data, off_t size, int notify_fd) {
+	li->data = data;
+	li->size = size;
+	li->offs = malloc(sizeof(off_t) * 2);
+	li->offs[0] = 0;
+	li->nlines = 0;
+	li->scanned = 0;
+	li->done = (size == 0);
+	li->comments = NULL;
+	li->ncomments = 0;
+	li->comments_done = 0;
+	li->lex = NULL;
+	li->syntax = NULL;
+	li->cancel = 0;
+	li->running = 0;
+	li->notify_fd = notify_fd;
+	pthread_mutex_init(&li->lock, NULL);
+}
+
+// Starts indexing the parts not loaded from cache on a background thread, comments are only
+// looked for if there's a lexer to find them with
+int lineIndexStart(struct lineIndex *li, lineIndexLexer lex, const void *syntax) {
+	li->lex = lex;
+	li->syntax = syntax;
+	if (li->done && (lex == NULL || li->comments_done)) return 0;
+	if (pthread_create(&li->thread, NULL, lineIndexScan, li) != 0) return -1;
+	li->running = 1;
+	return 0;
+}
+
+void lineIndexStop(struct lineIndex *li) {
+	if (li->running) {
+		li->cancel = 1;
+		pthread_join(li->thread, NULL);
+		li->running = 0;
+	}
+	pthread_mutex_destroy(&li->lock);
+	free(li->offs);
+	free(li->comments);
+	li->offs = NULL;
+	li->comments = NULL;
+}
+
+void lineIndexProgress(struct lineIndex *li, long long *nlines, off_t *scanned, int *done) {
+	pthread_mutex_lock(&li->lock);
+	if (nlines) *nlines = li->nlines;
+	if (scanned) *scanned = li->scanned;
+	if (done) *done = li->done;
+	pthread_mutex_unlock(&li->lock);
+}
+
+// Whether there's nothing left for the thread to do
+int lineIndexComplete(struct lineIndex *li) {
+	pthread_mutex_lock(&li->lock);
+	int complete = li->done && (li->lex == NULL || li->comments_done);
+	pthread_mutex_unlock(&li->lock);
+	return complete;
+}
+
+// Finds offset of a line, fails (returns -1) if indexing didn't get to it yet
+int lineIndexFind(struct lineIndex *li, long long line, off_t *offset) {
+	pthread_mutex_lock(&li->lock);
+	if (line < 0 || line >= li->nlines) {
+		pthread_mutex_unlock(&li->lock);
+		return -1;
+	}
+	off_t off = li->offs[line / LINEINDEX_STRIDE];
+	pthread_mutex_unlock(&li->lock);
+	
+	const char *end = li->data + li->size;
+	for (long long j = line % LINEINDEX_STRIDE; j > 0; j--) {
+		const char *nl = memchr(li->data + off, '\n', end - (li->data + off));
+		if (!nl) return -1; // fewer lines than a broken cache file claimed
+		off = nl + 1 - li->data;
+	}
+	*offset = off;
+	return 0;
+}
+
+// Number of the line starting at or containing the offset, -1 if indexing didn't get to it yet
+long long lineIndexLineOf(struct lineIndex *li, off_t offset) {
+	pthread_mutex_lock(&li->lock);
+	if (offset >= li->scanned && !li->done) {
+		pthread_mutex_unlock(&li->lock);
+		return -1;
+	}
+	long long lo = 0, hi = (li->nlines - 1) / LINEINDEX_STRIDE;
+	if (hi < 0) hi = 0;
+	while (lo < hi) {
+		long long mid = (lo + hi + 1) / 2;
+		if (li->offs[mid] <= offset) lo = mid;
+		else hi = mid - 1;
+	}
+	off_t off = li->offs[lo];
+	pthread_mutex_unlock(&li->lock);
+	
+	long long line = lo * LINEINDEX_STRIDE;
+	const char *p = li->data + off;
+	const char *target = li->data + offset;
+	while (p < target && (p = memchr(p, '\n', target - p)) != NULL) {
+		p++;
+		line++;
+	}
+	return line;
+}
+
+// Whether the line starting at offset begins inside of a multiline comment, -1 if it's not known yet
+int lineIndexCommentAt(struct lineIndex *li, off_t offset) {
+	long long line = lineIndexLineOf(li, offset);
+	if (line == -1) return -1;
+	
+	pthread_mutex_lock(&li->lock);
+	long long k = line / LINEINDEX_STRIDE;
+	if (k >= li->ncomments || li->lex == NULL) {
+		pthread_mutex_unlock(&li->lock);
+		return -1;
+	}
+	int in_comment = li->comments[k];
+	const char *p = li->data + li->offs[k];
+	pthread_mutex_unlock(&li->lock);
+	
+	const char *target = li->data + offset;
+	while (p < target) {
+		const char *nl = memchr(p, '\n', target - p);
+		if (!nl) break;
+		in_comment = li->lex(li->syntax, p, nl - p, in_comment);
+		p = nl + 1;
+	}
+	return in_comment;
+}
+
+/*** cache ***/
+
+// Creates the directory along with its missing parents
+static int lineIndexMkdirs(char *dir) {
+	for (char *p = dir + 1; *p; p++) {
+		if (*p != '/') continue;
+		*p = '\0';
+		int ret = mkdir(dir, 0700);
+		*p = '/';
+		if (ret == -1 && errno != EEXIST) return -1;
+	}
+	return (mkdir(dir, 0700) == -1 && errno != EEXIST) ? -1 : 0;
+}
+
+// Path of the file index of given (absolute) path is cached in, creating the cache directory if needed
+char *lineIndexCachePath(const char *path) {
+	char dir[4096];
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	if (xdg && xdg[0]) snprintf(dir, sizeof(dir), "%s/hecto", xdg);
+	else if (home && home[0]) snprintf(dir, sizeof(dir), "%s/.cache/hecto", home);
+	else return NULL;
+	if (lineIndexMkdirs(dir) == -1) return NULL;
+	
+	uint64_t hash = 14695981039346656037ULL; // FNV-1a
+	for (const char *p = path; *p; p++) hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+	
+	size_t len = strlen(dir) + 22;
+	char *cache = malloc(len);
+	snprintf(cache, len, "%s/%016llx.idx", dir, (unsigned long long)hash);
+	return cache;
+}
+
+static void lineIndexHeaderFill(struct lineIndexHeader *h, const char *path, const struct stat *st,
+	const char *lexer) {
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, "HECTOIDX", 8);
+	h->version = LINEINDEX_VERSION;
+	h->pathlen = strlen(path);
+	h->size = st->st_size;
+	h->mtime_sec = st->st_mtim.tv_sec;
+	h->mtime_nsec = st->st_mtim.tv_nsec;
+	h->ino = st->st_ino;
+	h->dev = st->st_dev;
+	if (lexer) strncpy(h->lexer, lexer, sizeof(h->lexer) - 1);
+}
+
+// Loads index from the cache file if it belongs to the same version of the file, comments are
+// only used if they were found with the same lexer -- returns -1 if there's no usable cache
+int lineIndexLoad(struct lineIndex *li, const char *cache, const char *path, const struct stat *st,
+	const char *lexer) {
+	FILE *fp = fopen(cache, "rb");
+	if (!fp) return -1;
+	
+	struct lineIndexHeader h, expect;
+	lineIndexHeaderFill(&expect, path, st, lexer);
+	char *stored = NULL;
+	off_t *offs = NULL;
+	unsigned char *comments = NULL;
+	
+	if (fread(&h, sizeof(h), 1, fp) != 1) goto fail;
+	if (memcmp(h.magic, expect.magic, 8) || h.version != expect.version || h.pathlen != expect.pathlen ||
+		h.size != expect.size || h.mtime_sec != expect.mtime_sec || h.mtime_nsec != expect.mtime_nsec ||
+		h.ino != expect.ino || h.dev != expect.dev || h.nlines < 0 || h.nlines > h.size || h.ncomments < 0) goto fail;
+	
+	stored = malloc(h.pathlen);
+	if (fread(stored, 1, h.pathlen, fp) != h.pathlen || memcmp(stored, path, h.pathlen)) goto fail;
+	
+	long long nstrides = lineIndexStrides(h.nlines);
+	offs = malloc(sizeof(off_t) * nstrides);
+	for (long long k = 0; k < nstrides; k++) {
+		int64_t off;
+		if (fread(&off, sizeof(off), 1, fp) != 1) goto fail;
+		// offsets are starts of lines in the file, increasing from the first one
+		if (k == 0 ? off != 0 : (off <= offs[k - 1] || off >= li->size || li->data[off - 1] != '\n')) goto fail;
+		offs[k] = off;
+	}
+	
+	if (h.ncomments == nstrides && !strncmp(h.lexer, expect.lexer, sizeof(h.lexer))) {
+		comments = malloc(nstrides);
+		if (fread(comments, 1, nstrides, fp) != (size_t)nstrides) goto fail;
+	}
+	fclose(fp);
+	free(stored);
+	
+	pthread_mutex_lock(&li->lock);
+	free(li->offs);
+	li->offs = offs;
+	li->nlines = h.nlines;
+	li->scanned = li->size;
+	li->done = 1;
+	if (comments) {
+		free(li->comments);
+		li->comments = comments;
+		li->ncomments = nstrides;
+		li->comments_done = 1;
+	}
+	pthread_mutex_unlock(&li->lock);
+	return 0;
+	
+fail:
+	fclose(fp);
+	free(stored);
+	free(offs);
+	free(comments);
+	return -1;
+}
+
+// Writes a complete index to the cache file, replacing it atomically
+int lineIndexSave(struct lineIndex *li, const char *cache, const char *path, const struct stat *st,
+	const char *lexer) {
+	if (!li->done) return -1;
+	
+	struct lineIndexHeader h;
+	lineIndexHeaderFill(&h, path, st, li->comments_done ? lexer : NULL);
+	long long nstrides = lineIndexStrides(li->nlines);
+	h.nlines = li->nlines;
+	h.ncomments = li->comments_done ? nstrides : 0;
+	
+	size_t len = strlen(cache) + 16;
+	char *tmp = malloc(len);
+	snprintf(tmp, len, "%s.%d", cache, (int)getpid());
+	FILE *fp = fopen(tmp, "wb");
+	if (!fp) {
+		free(tmp);
+		return -1;
+	}
+	
+	int ok = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(path, 1, h.pathlen, fp) == h.pathlen;
+	for (long long k = 0; ok && k < nstrides; k++) {
+		int64_t off = li->offs[k];
+		ok = fwrite(&off, sizeof(off), 1, fp) == 1;
+	}
+	if (ok && h.ncomments) ok = fwrite(li->comments, 1, nstrides, fp) == (size_t)nstrides;
+	if (fclose(fp) != 0) ok = 0;
+	
+	if (ok && rename(tmp, cache) == 0) {
+		free(tmp);
+		return 0;
+	}
+	unlink(tmp);
+	free(tmp);
+	return -1;
+}
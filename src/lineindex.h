@@ -0,0 +1,47 @@
+#ifndef _HECTO_LINEINDEX_H_
+#define _HECTO_LINEINDEX_H_
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define LINEINDEX_STRIDE 1024 // every how many lines an offset is stored
+#define LINEINDEX_VERSION 1 // bumped whenever format of the cache files changes
+
+// Tells whether a multiline comment is still open at the end of a line lexed with given syntax
+typedef int (*lineIndexLexer)(const void *syntax, const char *line, size_t len, int in_comment);
+
+// Sparse index of line offsets of a mapped file, built by a background thread
+struct lineIndex {
+	const char *data; // mapped file
+	off_t size; // size of mapped file
+	off_t *offs; // offs[k] is offset of line k * LINEINDEX_STRIDE
+	long long nlines; // lines found so far
+	off_t scanned; // bytes scanned so far
+	int done; // whether the whole file was scanned
+	unsigned char *comments; // comments[k] is whether line k * LINEINDEX_STRIDE starts inside of a comment
+	long long ncomments; // how many of comments are known
+	int comments_done; // whether comments of the whole file are known
+	lineIndexLexer lex; // lexer used to find comments, NULL when there's no need to
+	const void *syntax; // syntax the lexer is given, fixed once the thread starts
+	int cancel; // asks the thread to stop
+	int running; // whether the thread was started
+	int notify_fd; // a byte is written here whenever there's progress to show (-1 for none)
+	pthread_t thread;
+	pthread_mutex_t lock;
+};
+
+void lineIndexInit(struct lineIndex *li, const char *data, off_t size, int notify_fd);
+int lineIndexStart(struct lineIndex *li, lineIndexLexer lex, const void *syntax);
+void lineIndexStop(struct lineIndex *li);
+void lineIndexProgress(struct lineIndex *li, long long *nlines, off_t *scanned, int *done);
+int lineIndexComplete(struct lineIndex *li);
+int lineIndexFind(struct lineIndex *li, long long line, off_t *offset);
+long long lineIndexLineOf(struct lineIndex *li, off_t offset);
+int lineIndexCommentAt(struct lineIndex *li, off_t offset);
+
+char *lineIndexCachePath(const char *path);
+int lineIndexLoad(struct lineIndex *li, const char *cache, const char *path, const struct stat *st, const char *lexer);
+int lineIndexSave(struct lineIndex *li, const char *cache, const char *path, const struct stat *st, const char *lexer);
+
+#endif
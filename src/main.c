@@ -10,156 +10,434 @@
 #include "hecto.h"
 #include "terminal.h"
 #include "syntax.h"
+#include "codec.h"
+#include "utf8.h"
 
 #define CTRL_KEY(k) ((k) & 0x1f)	
 
-// only one editorConfig struct is ever initiated and it's called 'E' for convienece
+// the active buffer is always kept in the editorConfig struct called 'E' for convienece
 struct editorConfig E; 
 
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
 char* editorPrompt(char *prompt, void (*callback)(char *, int));
+int editorRowUpdateCheckpoints(erow *row, int state);
+void editorRowRenderWindow(erow *row, int rx);
+void editorRenderRow(erow *row);
+void editorDamage(int from, int to);
+void editorJournalRecord(int op, int c);
+void editorJournalRecordAt(int op, int y, int x, int c);
+void editorJournalRecordText(int y, int x, const char *s, int len);
+void editorClipboardEdit(int y);
+char *editorClipboardCopy();
+void editorOffsetLocate(long long offset, int *at, int *cx);
+void editorMoveCursor(int key);
+void editorJournalStart();
+void editorJournalReset(const char *edits, size_t len);
+int editorSaveWrite(struct editorSave *save, int fd);
+void editorModified(int at, int rows);
+void editorDiskWatch();
+void editorDiskForget();
+void editorJournalStop();
+void editorWindowForget(int id);
+void editorWrapUpdateRow(erow *row);
+void editorOffsetUpdateRow(erow *row);
+long long editorRowOffset(int at);
+void editorToggleFollow();
+void editorAddWatch(int fd, void (*handler)(int));
+void editorAddWriteWatch(int fd, void (*handler)(int));
+void editorRemoveWatch(int fd);
+int editorPagerOpen(char *filename);
 
 
 /*** syntax highlighting ***/
-int is_separator(int c) {
-	return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+// Lexer state carried from one row to the next and stored in long row checkpoints
+#define LEX_COMMENT (1<<0) // inside of a multiline comment
+#define LEX_SEP (1<<1) // previous character was a separator
+#define LEX_NUMBER (1<<2) // previous character was a part of a number
+#define LEX_ESCAPE (1<<3) // text ended with a backslash escaping the end of the row in an open string
+#define LEX_LONG (1<<4) // open string is a long one, its delimiter is LEX_ID in longs of the syntax
+#define LEX_DELIMITED (1<<5) // open string is a raw one like R"xy(...)xy", LEX_ID is its interned delimiter
+#define LEX_QUOTE(s) (((s) >> 8) & 0xff) // quote character of an open string
+#define LEX_ID(s) (((s) >> 16) & 0xff) // depth of a nested comment or delimiter of an open string
+#define LEX_INIT LEX_SEP // state at the beginning of a file
+
+// State the next row starts in: comments, long strings and strings with an escaped row end go on
+int editorLexCarry(int state) {
+	int carry = state & (LEX_COMMENT | LEX_ESCAPE | LEX_LONG | LEX_DELIMITED | (0xff << 16));
+	if (state & (LEX_ESCAPE | LEX_LONG | LEX_DELIMITED)) carry |= state & (0xff << 8);
+	return LEX_INIT | carry;
 }
 
-void editorUpdateSyntax(erow *row) {
-	row->hl = realloc(row->hl, row->rsize);
-	memset(row->hl, HL_NORMAL, row->rsize);
+// Delimiters of raw strings like R"xy(...)xy" are interned, so that lexer state only holds their id.
+// Lexer is also run by the line index thread, hence the lock.
+char *lexdelims[256];
+int nlexdelims = 0;
+pthread_mutex_t lexdelims_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Returns id of the delimiter, 0 stands for delimiters which didn't fit
+int editorLexDelimiter(const char *delim, int len) {
+	pthread_mutex_lock(&lexdelims_lock);
+	int id;
+	for (id = 1; id <= nlexdelims; id++)
+		if ((int)strlen(lexdelims[id - 1]) == len && !memcmp(lexdelims[id - 1], delim, len)) break;
+	if (id > nlexdelims) {
+		if (nlexdelims < 255) lexdelims[nlexdelims++] = strndup(delim, len);
+		else id = 0;
+	}
+	pthread_mutex_unlock(&lexdelims_lock);
+	return id;
+}
+
+// Closing sequence of the raw string, like )xy" for R"xy(
+void editorLexDelimiterEnd(int id, char *end) {
+	pthread_mutex_lock(&lexdelims_lock);
+	snprintf(end, 20, ")%s\"", id > 0 ? lexdelims[id - 1] : "");
+	pthread_mutex_unlock(&lexdelims_lock);
+}
+
+// Lex text with given syntax starting from *at until position stop is reached and return the lexer state at the position
+// where it stopped (stored back in *at) -- it can be past stop if a token crosses it. Highlights are
+// written to hl (indexed like text) unless it's NULL, which is used to only track the state.
+//
+// The lexer is driven by the character class table of the syntax: runs of characters without a class
+// which could start a token are highlighted at once, comments and strings are skipped to the next
+// character which could end them, and keywords are only compared with the ones starting alike.
+int editorLex(const struct editorSyntax *syntax, const char *text, int len, int *at, int stop, unsigned char *hl, int state) {
+	if (syntax == NULL) {
+		if (hl) memset(&hl[*at], HL_NORMAL, stop - *at);
+		*at = stop;
+		return state;
+	}
 	
-	if (E.syntax == NULL) return;
+	const struct syntaxCompiled *sc = &syntax->compiled;
+	const unsigned char *cc = sc->charclass;
+	char **keywords = syntax->keywords;
 	
-	char **keywords = E.syntax->keywords;
+	char *scs = syntax->singleline_comment_start;
+	char *mcs = syntax->multiline_comment_start;
+	char *mce = syntax->multiline_comment_end;
+	char *cls = syntax->custom_line_start;
+	int multiline = sc->mcs_len && sc->mce_len;
 	
-	char *scs = E.syntax->singleline_comment_start;
-	char *mcs = E.syntax->multiline_comment_start;
-	char *mce = E.syntax->multiline_comment_end;
-	char *cls = E.syntax->custom_line_start;
+	int prev_sep = (state & LEX_SEP) != 0;
+	int in_string = LEX_QUOTE(state);
+	int in_comment = (state & LEX_COMMENT) != 0; // for multiline comments
+	int id = LEX_ID(state); // depth of nested comment or delimiter of a long or raw string
+	int kind = state & (LEX_LONG | LEX_DELIMITED); // of the open string
+	int escaped = 0; // whether text ended with an escaping backslash
+	unsigned char prev_hl = (state & LEX_NUMBER) ? HL_NUMBER : HL_NORMAL;
+	int nested = syntax->flags & HL_NESTED_COMMENTS;
 	
-	int scs_len = scs ? strlen(scs) : 0;
-	int mcs_len = mcs ? strlen(mcs) : 0;
-	int mce_len = mce ? strlen(mce) : 0;
-	int cls_len = cls ? strlen(cls) : 0;
+	// what closes the open string and whether backslashes escape in it
+	char close_buf[20];
+	const char *close = NULL;
+	int close_len = 1, escapes = 1;
+	#define LEX_CLOSE() do { \
+		if (kind == LEX_LONG) { \
+			close = sc->longs[id]; \
+			close_len = sc->long_len[id]; \
+			escapes = !sc->long_raw[id]; \
+		} else if (kind == LEX_DELIMITED) { \
+			editorLexDelimiterEnd(id, close_buf); \
+			close = close_buf; \
+			close_len = strlen(close_buf); \
+			escapes = 0; \
+		} else { \
+			close_buf[0] = in_string; \
+			close = close_buf; \
+			close_len = 1; \
+			escapes = 1; \
+		} \
+	} while (0)
+	if (in_string) {
+		if (kind == LEX_LONG && id >= sc->nlongs) kind = 0; // syntax changed in the meantime
+		LEX_CLOSE();
+	}
 	
-	int prev_sep = 1;
-	int in_string = 0;
-	int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment); // for multiline comments
+	// sets highlight of n characters and remembers it for the next iteration
+	#define LEX_HL(from, n, type) do { \
+		if (hl) memset(&hl[from], type, n); \
+		prev_hl = type; \
+	} while (0)
 	
-	int i = 0;
-	while (i < row->rsize) {
-		char c = row->render[i];
-		unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
-		
-		// Custom line
-		if (cls_len && !in_string && !in_comment) {
-			if (!strncmp(&row->render[i], cls, cls_len)) {
-				memset(&row->hl[i], HL_CUSTOM, row->rsize - i);
-				break;
-			}
-		}
-
-		// Singleline comments
-		if (scs_len && !in_string && !in_comment) {
-			if (!strncmp(&row->render[i], scs, scs_len)) {
-				memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-				break;
-			}
-		}
+	// whether the delimiter of length n starts at i
+	#define LEX_AT(i, delim, n) ((n) && (i) + (n) <= len && !memcmp(&text[i], delim, n))
+	
+	int i = *at;
+	while (i < stop) {
+		unsigned char c = text[i];
 		
-		// Multiline comments
-		if (mcs_len && mce_len && !in_string) {
-			if (in_comment) {
-				row->hl[i] = HL_MLCOMMENT;
-				if(!strncmp(&row->render[i], mce, mce_len)) {
-					memset(&row->hl[i], HL_MLCOMMENT, mce_len);
-					i += mce_len;
+		// Multiline comments -- skipped to the next character which could end them (or open a nested one)
+		if (in_comment && multiline) {
+			int j = i;
+			if (nested) {
+				while (j < stop && text[j] != mce[0] && text[j] != mcs[0]) j++;
+			} else {
+				const char *end = memchr(&text[i], mce[0], stop - i);
+				j = end ? end - text : stop;
+			}
+			if (j > i) LEX_HL(i, j - i, HL_MLCOMMENT);
+			i = j;
+			if (i == stop) break;
+			if (LEX_AT(i, mce, sc->mce_len)) {
+				LEX_HL(i, sc->mce_len, HL_MLCOMMENT);
+				i += sc->mce_len;
+				if (id > 0) {
+					id--;
+				} else {
 					in_comment = 0;
 					prev_sep = 1;
-					continue;
-				} else {
-					i++;
-					continue;
 				}
-			} else if (!strncmp(&row->render[i], mcs, mcs_len)) {
-				memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
-				i += mcs_len;
-				in_comment = 1;
-				continue;
+			} else if (nested && LEX_AT(i, mcs, sc->mcs_len)) {
+				LEX_HL(i, sc->mcs_len, HL_MLCOMMENT);
+				i += sc->mcs_len;
+				if (id < 0xff) id++;
+			} else {
+				LEX_HL(i, 1, HL_MLCOMMENT);
+				i++;
 			}
+			continue;
 		}
 		
-		// Strings
-		if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
-			if (in_string) {
-				row->hl[i] = HL_STRING;
-				
-				if (c == '\\' && i + 1 < row->size) {
-					row->hl[i + 1] = HL_STRING;
+		// Strings -- skipped to the next character which could close them or an escape
+		if (in_string && (syntax->flags & HL_HIGHLIGHT_STRINGS)) {
+			int j = i;
+			while (j < stop && text[j] != close[0] && !(escapes && text[j] == '\\')) j++;
+			if (j > i) {
+				LEX_HL(i, j - i, HL_STRING);
+				prev_sep = 1;
+			}
+			i = j;
+			if (i == stop) break;
+			if (escapes && text[i] == '\\') {
+				if (i + 1 < len) {
+					LEX_HL(i, 2, HL_STRING);
 					i += 2;
 					continue;
 				}
-				
-				if (c == in_string) in_string = 0;
+				escaped = 1; // string goes on in the next row
+			}
+			if (!escaped && LEX_AT(i, close, close_len)) {
+				LEX_HL(i, close_len, HL_STRING);
+				i += close_len;
+				in_string = 0;
+				kind = 0;
+				id = 0;
+			} else {
+				LEX_HL(i, 1, HL_STRING);
 				i++;
-				prev_sep = 1;
+			}
+			prev_sep = 1;
+			continue;
+		}
+		
+		// Plain text -- a run of characters which can't start a token
+		int special = SYNTAX_DELIM | SYNTAX_QUOTE;
+		if (prev_hl != HL_NUMBER && !(cc[c] & special) && !(prev_sep && (cc[c] & (SYNTAX_DIGIT | SYNTAX_KEYWORD)))) {
+			int j = i;
+			do {
+				prev_sep = cc[(unsigned char)text[j]] & SYNTAX_SEP;
+				j++;
+				if (j == stop) break;
+				c = text[j];
+			} while (!(cc[c] & special) && !(prev_sep && (cc[c] & (SYNTAX_DIGIT | SYNTAX_KEYWORD))));
+			LEX_HL(i, j - i, HL_NORMAL);
+			i = j;
+			continue;
+		}
+		
+		if (cc[c] & SYNTAX_DELIM && !in_string && !in_comment) {
+			// Custom line
+			if (LEX_AT(i, cls, sc->cls_len)) {
+				LEX_HL(i, len - i, HL_CUSTOM);
+				i = len;
+				break;
+			}
+			
+			// Singleline comments
+			if (LEX_AT(i, scs, sc->scs_len)) {
+				LEX_HL(i, len - i, HL_COMMENT);
+				i = len;
+				break;
+			}
+			
+			// Multiline comments
+			if (multiline && LEX_AT(i, mcs, sc->mcs_len)) {
+				LEX_HL(i, sc->mcs_len, HL_MLCOMMENT);
+				i += sc->mcs_len;
+				in_comment = 1;
+				id = 0;
 				continue;
-				
-			} else {
-				if (c == '"' || c == '\'') {
-					in_string = c;
-					row->hl[i] = HL_STRING;
-					i++;
+			}
+			
+			// Long strings
+			int k;
+			for (k = 0; k < sc->nlongs && !LEX_AT(i, sc->longs[k], sc->long_len[k]); k++);
+			if (k < sc->nlongs) {
+				LEX_HL(i, sc->long_len[k], HL_STRING);
+				i += sc->long_len[k];
+				in_string = c;
+				kind = LEX_LONG;
+				id = k;
+				LEX_CLOSE();
+				continue;
+			}
+			
+			// Raw strings like R"xy(...)xy", the delimiter can be at most 16 characters long
+			if (c == 'R' && (syntax->flags & HL_DELIMITED_STRINGS) && i + 1 < len && text[i + 1] == '"' &&
+				(prev_sep || (i > 0 && memchr("LuU8", text[i - 1], 4)))) {
+				int j = i + 2;
+				while (j < len && j - i - 2 <= 16 && text[j] != '(' && !memchr(" ()\\\t\"", text[j], 6)) j++;
+				if (j < len && text[j] == '(' && j - i - 2 <= 16) {
+					LEX_HL(i, j + 1 - i, HL_STRING);
+					id = editorLexDelimiter(&text[i + 2], j - i - 2);
+					i = j + 1;
+					in_string = '"';
+					kind = LEX_DELIMITED;
+					LEX_CLOSE();
 					continue;
 				}
 			}
 		}
 		
+		// Strings
+		if (cc[c] & SYNTAX_QUOTE) {
+			in_string = c;
+			kind = 0;
+			LEX_CLOSE();
+			LEX_HL(i, 1, HL_STRING);
+			i++;
+			continue;
+		}
+		
 		// Numbers 
-		if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
-			if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) || 
+		if (syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+			if (((cc[c] & SYNTAX_DIGIT) && (prev_sep || prev_hl == HL_NUMBER)) || 
 				(c == '.' && prev_hl == HL_NUMBER) ||
 				(c == 'x' && prev_hl == HL_NUMBER)) {
 					
-				row->hl[i] = HL_NUMBER;
+				LEX_HL(i, 1, HL_NUMBER);
 				i++;
 				prev_sep = 0;
 				continue;
 			}
 		}
 		
-		// Keywords
-		if (prev_sep) {
-			int j;
-			for (j = 0; keywords[j]; j++) {
-				int klen = strlen(keywords[j]);
-				int kw2 = keywords[j][klen - 1] == '|';
-				if (kw2) klen--;
+		// Keywords -- only the ones starting with the character are compared
+		if (prev_sep && (cc[c] & SYNTAX_KEYWORD)) {
+			int k;
+			for (k = sc->keyword_first[c]; k < sc->keyword_first[c + 1]; k++) {
+				int kw = sc->keyword_order[k];
+				int klen = sc->keyword_len[kw];
 				
-				if (!strncmp(&row->render[i], keywords[j], klen) && 
-					is_separator(row->render[i + klen])) {
+				if (LEX_AT(i, keywords[kw], klen) && 
+					(i + klen == len || (cc[(unsigned char)text[i + klen]] & SYNTAX_SEP))) {
 					
-					memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+					LEX_HL(i, klen, sc->keyword_kw2[kw] ? HL_KEYWORD2 : HL_KEYWORD1);
 					i += klen;
 					break;
 				}
 			}
-			if (keywords[j] != NULL) {
+			if (k < sc->keyword_first[c + 1]) {
 				prev_sep = 0;
 				continue;
 			}
 		}
 		
-		prev_sep = is_separator(c);
+		LEX_HL(i, 1, HL_NORMAL);
+		prev_sep = cc[c] & SYNTAX_SEP;
 		i++;
 	}
+	#undef LEX_HL
+	#undef LEX_AT
+	#undef LEX_CLOSE
 	
-	int changed = (row->hl_open_comment != in_comment);
-	row->hl_open_comment = in_comment;
-	if (changed && row->idx + 1 < E.numrows)
-		editorUpdateSyntax(&E.row[row->idx + 1]);
+	*at = i;
+	return (in_comment ? LEX_COMMENT : 0) | (prev_sep ? LEX_SEP : 0) |
+		(prev_hl == HL_NUMBER ? LEX_NUMBER : 0) | (in_string << 8) |
+		(in_string && escaped ? LEX_ESCAPE : 0) | (in_string ? kind : 0) |
+		((in_comment || (in_string && kind)) ? id << 16 : 0);
+}
+
+// Tells whether a multiline comment is open at the end of a line -- used by the line index thread
+// to find comments of files in pager mode, with the syntax of the file when indexing started
+int editorLexComment(const void *syntax, const char *line, size_t len, int in_comment) {
+	int at = 0;
+	if (len > INT_MAX) len = INT_MAX;
+	int state = editorLex(syntax, line, len, &at, len, NULL, LEX_INIT | (in_comment ? LEX_COMMENT : 0));
+	return (state & LEX_COMMENT) != 0;
+}
+
+struct hlCache hlcache; // highlights of rows of all buffers by their content
+
+// Lexes a whole row, rows seen before with the same state are highlighted from the cache
+int editorLexRow(const char *text, int len, unsigned char *hl, int state) {
+	int at = 0;
+	if (!E.syntax || len > HLCACHE_MAXLEN) return editorLex(E.syntax, text, len, &at, len, hl, state);
+	uint64_t hash = hlCacheHash(E.syntax, text, len, state);
+	int exit;
+	if (hlCacheGet(&hlcache, hash, E.syntax, text, len, state, hl, &exit)) return exit;
+	exit = editorLex(E.syntax, text, len, &at, len, hl, state);
+	hlCachePut(&hlcache, hash, E.syntax, text, len, state, hl, exit);
+	return exit;
+}
+
+// Highlights the row and the following ones whose state changed because of it. Rows after a row
+// with unknown state are left stale and get highlighted once they are needed (editorSyntaxEnsure).
+void editorUpdateSyntax(erow *row) {
+	while (row) {
+		int state = LEX_INIT;
+		if (row->idx > 0) {
+			erow *prev = &E.row[row->idx - 1];
+			if (!prev->hl_valid) {
+				row->hl_valid = 0;
+				return;
+			}
+			state = prev->hl_state;
+		} else if (E.pager && E.pager_comment == 1) {
+			state |= LEX_COMMENT;
+		}
+		
+		if (row->render == NULL && !row->ckpt) editorRenderRow(row); // evicted to save memory
+		
+		int old = row->hl_state;
+		if (row->ckpt) {
+			// long rows are highlighted only around the rendered window
+			state = editorRowUpdateCheckpoints(row, state);
+			editorRowRenderWindow(row, row->roff);
+			editorWrapUpdateRow(row);
+		} else {
+			row->hl = realloc(row->hl, row->rsize);
+			state = editorLexRow(row->render, row->rsize, row->hl, state);
+		}
+		row->hl_valid = 1;
+		editorDamage(row->idx, row->idx);
+		
+		row->hl_state = editorLexCarry(state);
+		row = (row->hl_state != old && row->idx + 1 < E.numrows) ? &E.row[row->idx + 1] : NULL;
+		if (row && !row->hl_valid) row = NULL;
+	}
+}
+
+// Makes sure highlight of the row is up to date. Stale rows above it are highlighted first, but at most
+// HECTO_HL_SYNC of them -- beyond that the state is guessed, so jumping far into a file stays cheap.
+void editorSyntaxEnsure(int at) {
+	if (at < 0 || at >= E.numrows || E.row[at].hl_valid) return;
+	int from = at;
+	while (from > 0 && !E.row[from - 1].hl_valid && at - from < HECTO_HL_SYNC) from--;
+	if (from > 0 && !E.row[from - 1].hl_valid) {
+		// in pager mode the state is known from the line index
+		int in_comment = E.pager ? lineIndexCommentAt(E.pager_index, E.pager_offs[from]) : 0;
+		E.row[from - 1].hl_state = LEX_INIT | (in_comment == 1 ? LEX_COMMENT : 0);
+		E.row[from - 1].hl_valid = 1; // only its exit state is used, highlight itself stays stale
+		editorUpdateSyntax(&E.row[from]);
+		E.row[from - 1].hl_valid = 0;
+	} else {
+		editorUpdateSyntax(&E.row[from]);
+	}
+	for (int j = from + 1; j <= at; j++)
+		if (!E.row[j].hl_valid) editorUpdateSyntax(&E.row[j]);
 }
 
 void editorSyntaxToColor(int hl, int *color_fg, int *color_bg, int* effect) {
@@ -183,6 +461,10 @@ void editorSyntaxToColor(int hl, int *color_fg, int *color_bg, int* effect) {
 			*color_bg = 47;
 			*effect = 5;
 			break;
+		case HL_SELECT:
+			*color_fg = 37;
+			*color_bg = 44;
+			break;
 		case HL_STRING: 
 			*color_fg = 35;
 			break;
@@ -196,26 +478,55 @@ void editorSyntaxToColor(int hl, int *color_fg, int *color_bg, int* effect) {
 	}
 }
 
+struct editorSyntax *syntaxes; // builtin syntaxes and the ones loaded from syntax files
+int nsyntaxes = 0;
+
+// Builds the syntax database once at startup, syntax files replace builtin syntaxes of the same filetype
+void editorSyntaxInit() {
+	nsyntaxes = HLDB_ENTRIES;
+	syntaxes = malloc(sizeof(HLDB));
+	memcpy(syntaxes, HLDB, sizeof(HLDB));
+	
+	char err[256] = "";
+	char *dir = syntaxFileDir();
+	if (dir) syntaxFileLoadDir(dir, &syntaxes, &nsyntaxes, err, sizeof(err));
+	free(dir);
+	for (int j = 0; j < nsyntaxes; j++) syntaxFileCompile(&syntaxes[j]);
+	if (err[0]) editorSetStatusMessage("%s", err);
+}
+
 void editorSelectSyntaxHighlight() {
 	E.syntax = NULL;
+	
+	// every row gets highlighted again once it's displayed
+	editorDamage(0, INT_MAX);
+	for (int filerow = 0; filerow < E.numrows; filerow++) {
+		E.row[filerow].hl_valid = 0;
+		if (E.row[filerow].ckpt) E.row[filerow].ckpt_dirty = 1;
+	}
+	
 	if (E.filename == NULL) return;
 	
 	char *ext = strrchr(E.filename, '.');
+	size_t ext_len = ext ? strlen(ext) : 0;
 	
-	for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
-		struct editorSyntax *s = &HLDB[j];
+	// compressed files are highlighted like the file they were compressed from
+	if (ext && E.codec) {
+		char *end = ext;
+		ext = NULL;
+		for (char *p = end - 1; p >= E.filename && *p != '/' && !ext; p--)
+			if (*p == '.') ext = p;
+		ext_len = ext ? end - ext : 0;
+	}
+	
+	for (int j = 0; j < nsyntaxes; j++) {
+		struct editorSyntax *s = &syntaxes[j];
 		unsigned int i = 0;
 		while (s->filematch[i]) {
 			int is_ext = (s->filematch[i][0] == '.');
-			if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+			if ((is_ext && ext && strlen(s->filematch[i]) == ext_len && !strncmp(ext, s->filematch[i], ext_len)) ||
 				(!is_ext && strstr(E.filename, s->filematch[i]))) {
 				E.syntax = s;
-
-				int filerow;
-				for (filerow = 0; filerow < E.numrows; filerow++) {
-					editorUpdateSyntax(&E.row[filerow]);
-				}
-				
 				return;
 			}
 			i++;
@@ -224,36 +535,249 @@ void editorSelectSyntaxHighlight() {
 }
 
 
+/*** long rows ***/
+
+// Rows longer than HECTO_LONGLINE are never rendered or highlighted as a whole. Instead they keep
+// a checkpoint every ~HECTO_CHUNK characters (position, rendered position and lexer state) and only
+// the part around the visible columns gets rendered, so editing and scrolling them stays cheap.
+
+// Returns rendered position after the character at j that starts at rendered position rx, *next is
+// set to the position of the following character. Characters are decoded from UTF-8, len is the end of text.
+static inline int editorCharAdvance(const char *chars, int j, int len, int rx, int *next) {
+	unsigned char c = chars[j];
+	if (c == '\t') {
+		*next = j + 1;
+		return rx + HECTO_TAB_STOP - (rx % HECTO_TAB_STOP);
+	}
+	if (c < 0x80) {
+		*next = j + 1;
+		return rx + 1;
+	}
+	int n;
+	rx += utf8CharWidth(&chars[j], len - j, &n);
+	*next = j + n;
+	return rx;
+}
+
+// Returns rendered position after the characters from..to that start at rendered position rx.
+// Rows are NUL terminated, so a character crossing to is counted whole and skipped when it's from.
+int editorCharsWidth(const char *chars, int from, int to, int rx) {
+	for (int j = utf8Skip(chars, from, to + 3); j < to; )
+		rx = editorCharAdvance(chars, j, to + 3, rx, &j);
+	return rx;
+}
+
+// Renders characters from..to that start at rendered position rx into out, expanding Tabs.
+// Returns number of bytes written, *width is set to the rendered position after them.
+int editorRenderChars(const char *chars, int from, int to, int rx, char *out, int *width) {
+	int idx = 0;
+	for (int j = from; j < to; ) {
+		int next;
+		int end = editorCharAdvance(chars, j, to, rx, &next);
+		if (chars[j] == '\t') {
+			memset(&out[idx], ' ', end - rx);
+			idx += end - rx;
+		} else {
+			memcpy(&out[idx], &chars[j], next - j);
+			idx += next - j;
+		}
+		rx = end;
+		j = next;
+	}
+	*width = rx;
+	return idx;
+}
+
+// Index of the last checkpoint at or before character position cx (or rendered position rx)
+int editorRowFindCheckpoint(erow *row, int pos, int by_rx) {
+	int lo = 0, hi = row->nckpt - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		int at = by_rx ? row->ckpt[mid].rx : row->ckpt[mid].cx;
+		if (at <= pos) lo = mid;
+		else hi = mid - 1;
+	}
+	return lo;
+}
+
+// Moves checkpoints after an edit of delta characters at position at and marks the ones affected by it
+void editorRowShiftCheckpoints(erow *row, int at, int delta) {
+	if (!row->ckpt) return;
+	int first = editorRowFindCheckpoint(row, at, 0) + 1;
+	for (int j = first; j < row->nckpt; j++) {
+		row->ckpt[j].cx += delta;
+		if (row->ckpt[j].cx < at) row->ckpt[j].cx = at;
+	}
+	if (first < row->ckpt_dirty) row->ckpt_dirty = first;
+}
+
+void editorRowInsertCheckpoint(erow *row, int j, int cx, int rx, int state) {
+	row->ckpt = realloc(row->ckpt, sizeof(struct erowCheckpoint) * (row->nckpt + 1));
+	memmove(&row->ckpt[j + 1], &row->ckpt[j], sizeof(struct erowCheckpoint) * (row->nckpt - j));
+	row->ckpt[j].cx = cx;
+	row->ckpt[j].rx = rx;
+	row->ckpt[j].state = state;
+	row->nckpt++;
+}
+
+// Recomputes checkpoints invalidated since the last update, stopping as soon as they agree with
+// the old ones again. Returns the lexer state the next row starts in.
+int editorRowUpdateCheckpoints(erow *row, int state) {
+	if (row->ckpt[0].state != state) {
+		row->ckpt[0].state = state;
+		row->ckpt_dirty = 1;
+	}
+	
+	int j = row->ckpt_dirty;
+	while (j <= row->nckpt) {
+		struct erowCheckpoint *prev = &row->ckpt[j - 1];
+		int stop = prev->cx + HECTO_CHUNK;
+		if (j < row->nckpt) {
+			if (row->ckpt[j].cx <= prev->cx) { // collapsed by a deletion
+				memmove(&row->ckpt[j], &row->ckpt[j + 1], sizeof(struct erowCheckpoint) * (row->nckpt - j - 1));
+				row->nckpt--;
+				continue;
+			}
+			if (row->ckpt[j].cx - prev->cx <= 2 * HECTO_CHUNK) stop = row->ckpt[j].cx;
+		}
+		if (stop > row->size) stop = row->size;
+		stop = utf8Skip(row->chars, stop, row->size); // checkpoints are kept between characters
+		
+		int at = prev->cx;
+		int st = editorLex(E.syntax, row->chars, row->size, &at, stop, NULL, prev->state);
+		int rx = editorCharsWidth(row->chars, prev->cx, at, prev->rx);
+		
+		if (at >= row->size) { // reached the end of row
+			row->nckpt = j;
+			row->rwidth = rx;
+			row->hl_state = editorLexCarry(st);
+			break;
+		}
+		
+		// drop old checkpoints overrun by a token crossing them
+		while (j < row->nckpt && row->ckpt[j].cx < at) {
+			memmove(&row->ckpt[j], &row->ckpt[j + 1], sizeof(struct erowCheckpoint) * (row->nckpt - j - 1));
+			row->nckpt--;
+		}
+		
+		if (j < row->nckpt && row->ckpt[j].cx == at) {
+			struct erowCheckpoint *ck = &row->ckpt[j];
+			int diff = rx - ck->rx;
+			if (ck->state == st && diff % HECTO_TAB_STOP == 0) {
+				// rest of the row lexes the same way and its tabs keep their widths
+				for (int k = j; k < row->nckpt; k++) row->ckpt[k].rx += diff;
+				row->rwidth += diff;
+				break;
+			}
+			ck->rx = rx;
+			ck->state = st;
+		} else {
+			editorRowInsertCheckpoint(row, j, at, rx, st);
+		}
+		j++;
+	}
+	row->ckpt_dirty = row->nckpt;
+	return row->hl_state;
+}
+
+// Renders and highlights the part of a long row starting at rendered position rx (or a bit before it)
+void editorRowRenderWindow(erow *row, int rx) {
+	if (!row->ckpt) return;
+	struct erowCheckpoint *ck = &row->ckpt[editorRowFindCheckpoint(row, rx < 0 ? 0 : rx, 1)];
+	int end_rx = rx + 2 * E.screencols;
+	
+	int cx = ck->cx;
+	int cur_rx = ck->rx;
+	while (cx < row->size && cur_rx < end_rx)
+		cur_rx = editorCharAdvance(row->chars, cx, row->size, cur_rx, &cx);
+	if (cx > row->size) cx = row->size;
+	
+	// bytes of characters plus Tabs expanded to spaces
+	free(row->render);
+	row->render = malloc((cx - ck->cx) + (cur_rx - ck->rx) + 1);
+	int idx = editorRenderChars(row->chars, ck->cx, cx, ck->rx, row->render, &cur_rx);
+	row->render[idx] = '\0';
+	row->rsize = idx;
+	row->roff = ck->rx;
+	row->rcols = cur_rx - ck->rx;
+	row->rutf8 = !utf8IsAscii(row->render, row->rsize);
+	
+	row->hl = realloc(row->hl, row->rsize);
+	int at = 0;
+	editorLex(E.syntax, row->render, row->rsize, &at, row->rsize, row->hl, ck->state);
+}
+
+// Position in render of the character at rendered position rx
+int editorRenderOffset(erow *row, int rx) {
+	if (!row->rutf8) return rx - row->roff;
+	int col = row->roff;
+	int j = 0;
+	while (j < row->rsize) {
+		int n;
+		col += utf8CharWidth(&row->render[j], row->rsize - j, &n);
+		if (col > rx) break;
+		j += n;
+	}
+	return j;
+}
+
+// Makes sure that columns from rx to rx + width of a long row are rendered
+void editorRowPrepareWindow(erow *row, int rx, int width) {
+	if (!row->ckpt) return;
+	int end = rx + width;
+	if (end > row->rwidth) end = row->rwidth;
+	if (rx < row->roff || end > row->roff + row->rcols)
+		editorRowRenderWindow(row, rx);
+}
+
+
 /*** row operations ***/
 
 // Convert cursor's position in file to it's rendered position which includes Tabs	
 int editorRowCxToRx(erow *row, int cx) {
-	int rx = 0;
-	int j;
-	for (j = 0; j < cx; j++) {
-		if (row->chars[j] == '\t')
-			rx += (HECTO_TAB_STOP - 1) - (rx % HECTO_TAB_STOP);
-		rx++;
+	if (row->ckpt) {
+		struct erowCheckpoint *ck = &row->ckpt[editorRowFindCheckpoint(row, cx, 0)];
+		return editorCharsWidth(row->chars, ck->cx, cx, ck->rx);
 	}
-	return rx;
+	return editorCharsWidth(row->chars, 0, cx, 0);
 }
 
 // Convert cursor's rendered postion to it's position inside file
 int editorRowRxToCx(erow *row, int rx) {
 	int cur_rx = 0;
-	int cx;
-	for (cx = 0; cx < row->size; cx++) {
-		if (row->chars[cx] == '\t')
-			cur_rx += (HECTO_TAB_STOP - 1) - (cur_rx % HECTO_TAB_STOP);
-		cur_rx++;
-		
+	int cx = 0;
+	if (row->ckpt) {
+		struct erowCheckpoint *ck = &row->ckpt[editorRowFindCheckpoint(row, rx, 1)];
+		cur_rx = ck->rx;
+		cx = ck->cx;
+	}
+	while (cx < row->size) {
+		int next;
+		cur_rx = editorCharAdvance(row->chars, cx, row->size, cur_rx, &next);
 		if (cur_rx > rx) return cx;
+		cx = next;
 	}
-	return cx;
+	return row->size;
 }
 
 // Render row including Tabs -- influences rendered position of cursor
-void editorUpdateRow(erow *row) {
+void editorRenderRow(erow *row) {
+	if (row->size > HECTO_LONGLINE) {
+		if (!row->ckpt) {
+			row->nckpt = 0;
+			editorRowInsertCheckpoint(row, 0, 0, 0, LEX_INIT);
+			row->ckpt_dirty = 1;
+			row->rwidth = editorCharsWidth(row->chars, 0, row->size, 0);
+		}
+		return; // rendered together with the highlight
+	}
+	if (row->ckpt) {
+		free(row->ckpt);
+		row->ckpt = NULL;
+		row->nckpt = 0;
+		row->roff = 0;
+	}
+	
 	int tabs = 0;
 	int j;
 	for (j = 0; j < row->size; j++)
@@ -262,18 +786,63 @@ void editorUpdateRow(erow *row) {
 	free(row->render);
 	row->render = malloc(row->size + tabs*(HECTO_TAB_STOP - 1) + 1);
 	
+	// bytes of ASCII rows are their columns, others are decoded from UTF-8
 	int idx = 0;
-	for (j = 0; j < row->size; j++) {
-		if (row->chars[j] == '\t') {
-			row->render[idx++] = ' ';
-			while (idx % HECTO_TAB_STOP != 0) row->render[idx++] = ' ';
-		} else {
-			row->render[idx++] = row->chars[j];
+	row->rutf8 = !utf8IsAscii(row->chars, row->size);
+	if (row->rutf8) {
+		idx = editorRenderChars(row->chars, 0, row->size, 0, row->render, &row->rwidth);
+	} else {
+		for (j = 0; j < row->size; j++) {
+			if (row->chars[j] == '\t') {
+				row->render[idx++] = ' ';
+				while (idx % HECTO_TAB_STOP != 0) row->render[idx++] = ' ';
+			} else {
+				row->render[idx++] = row->chars[j];
+			}
 		}
+		row->rwidth = idx;
 	}
 	row->render[idx] = '\0';
 	row->rsize = idx;
+	row->rcols = row->rwidth;
+}
+
+void editorUpdateRow(erow *row) {
+	editorRenderRow(row);
 	editorUpdateSyntax(row);
+	editorWrapUpdateRow(row);
+	editorOffsetUpdateRow(row);
+}
+
+// Fill in a new row with a copy of given text, it's neither rendered nor highlighted yet
+void editorInitRow(erow *row, int at, const char *s, size_t len) {
+	row->idx = at;
+	
+	row->size = len;
+	row->saved_size = len;
+	row->chars = malloc(len + 1);
+	memcpy(row->chars, s, len);
+	row->chars[len] = '\0';
+	
+	row->rsize = 0;
+	row->rwidth = 0;
+	row->rcols = 0;
+	row->rutf8 = 0;
+	row->roff = 0;
+	row->render = NULL;
+	row->hl = NULL;
+	row->hl_valid = 0;
+	row->hl_state = LEX_INIT;
+	row->ckpt = NULL;
+	row->nckpt = 0;
+	row->wrap_h = 1;
+}
+
+// Remembers a row changed since the file was saved, rows tells whether rows were inserted or deleted
+void editorModified(int at, int rows) {
+	if (at < E.mod_from) E.mod_from = at;
+	if (at > E.mod_to) E.mod_to = at;
+	if (rows) E.mod_rows = 1;
 }
 
 // Parse row into editor memory
@@ -283,28 +852,67 @@ void editorInsertRow(int at, char *s, size_t len) {
 	E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
 	memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
 	for (int j = at + 1; j <= E.numrows; j++) E.row[j].idx++;
+	E.wrap_dirty = 1;
+	E.offset_dirty = 1;
+	editorDamage(at, INT_MAX);
 	
-	E.row[at].idx = at;
-	
-	E.row[at].size = len;
-	E.row[at].chars = malloc(len + 1);
-	memcpy(E.row[at].chars, s, len);
-	E.row[at].chars[len] = '\0';
-	
-	E.row[at].rsize = 0;
-	E.row[at].render = NULL;
-	E.row[at].hl = NULL;
-	E.row[at].hl_open_comment = 0;
+	editorInitRow(&E.row[at], at, s, len);
 	editorUpdateRow(&E.row[at]);
 	
 	E.numrows++;
 	E.dirty++;
+	editorModified(at, 1);
+}
+
+// Appends text to the end of file splitting it into rows. Last row is continued while *open_row says
+// it wasn't terminated by a newline yet. New rows are rendered, but highlighted only once displayed.
+void editorAppendText(const char *buf, size_t len, int *open_row) {
+	const char *end = buf + len;
+	
+	// make room for all new rows at once
+	int lines = 0;
+	for (const char *p = buf; (p = memchr(p, '\n', end - p)) != NULL; p++) lines++;
+	E.row = realloc(E.row, sizeof(erow) * (E.numrows + lines + 1));
+	E.wrap_dirty = 1;
+	E.offset_dirty = 1;
+	editorDamage((*open_row && E.numrows > 0) ? E.numrows - 1 : E.numrows, INT_MAX);
+	
+	while (buf < end) {
+		const char *nl = memchr(buf, '\n', end - buf);
+		size_t linelen = (nl ? nl : end) - buf;
+		
+		erow *row;
+		if (*open_row && E.numrows > 0) {
+			row = &E.row[E.numrows - 1];
+			row->chars = realloc(row->chars, row->size + linelen + 1);
+			memcpy(&row->chars[row->size], buf, linelen);
+			row->size += linelen;
+			row->chars[row->size] = '\0';
+		} else {
+			row = &E.row[E.numrows];
+			editorInitRow(row, E.numrows, buf, linelen);
+			E.numrows++;
+		}
+		if (nl) {
+			while (row->size > 0 && row->chars[row->size - 1] == '\r') {
+				row->chars[--row->size] = '\0';
+				E.crlf = 1;
+			}
+		}
+		row->hl_valid = 0;
+		if (row->ckpt) row->ckpt_dirty = 1;
+		editorRenderRow(row);
+		
+		*open_row = (nl == NULL);
+		buf = nl ? nl + 1 : end;
+	}
 }
 
 void editorFreeRow(erow *row) {
 	free(row->render);
 	free(row->chars);
 	free(row->hl);
+	free(row->ckpt);
 }
 
 void editorDelRow(int at) {
@@ -312,8 +920,12 @@ void editorDelRow(int at) {
 	editorFreeRow(&E.row[at]);
 	memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
 	for (int j = at; j < E.numrows - 1; j++) E.row[j].idx--;
+	E.wrap_dirty = 1;
+	E.offset_dirty = 1;
+	editorDamage(at, INT_MAX);
 	E.numrows--;
 	E.dirty++;
+	editorModified(at, 1);
 }
 
 // Insert char at current cursor position
@@ -323,32 +935,67 @@ void editorRowInsertChar(erow *row, int at, int c) {
 	memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
 	row->size++;
 	row->chars[at] = c;
+	editorRowShiftCheckpoints(row, at, 1);
 	editorUpdateRow(row);
 	E.dirty++;
+	editorModified(row->idx, 0);
 }
 
 void editorRowAppendString(erow *row, char *s, size_t len) {
 	row->chars = realloc(row->chars, row->size + len + 1);
 	memcpy(&row->chars[row->size], s, len);
+	editorRowShiftCheckpoints(row, row->size, len);
 	row->size += len;
 	row->chars[row->size] = '\0';
 	editorUpdateRow(row);
 	E.dirty++;
+	editorModified(row->idx, 0);
 }
 
-// Overwrites character at given position with characters to its right
+// Overwrites character at given position with characters to its right, all bytes of a UTF-8 one
 void editorRowDelChar(erow *row, int at) {
 	if (at < 0 || at >= row->size) return;
-	memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-	row->size--;
+	int len = utf8Next(row->chars, at, row->size) - at;
+	memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+	row->size -= len;
+	editorRowShiftCheckpoints(row, at, -len);
 	editorUpdateRow(row);
 	E.dirty++;
+	editorModified(row->idx, 0);
 }	
 
+// Inserts text without newlines at position at of the row, it's rendered and highlighted by the caller
+void editorRowInsertText(erow *row, int at, const char *s, size_t len) {
+	row->chars = realloc(row->chars, row->size + len + 1);
+	memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+	memcpy(&row->chars[at], s, len);
+	row->size += len;
+	editorRowShiftCheckpoints(row, at, len);
+	editorModified(row->idx, 0);
+}
+
+// Deletes len bytes from position at of the row, it's rendered and highlighted by the caller
+void editorRowDelText(erow *row, int at, int len) {
+	memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+	row->size -= len;
+	editorRowShiftCheckpoints(row, at, -len);
+	editorModified(row->idx, 0);
+}
+
 
 /*** editor operations ***/
 
+// Tells whether editing is disabled, letting the user know about it
+int editorReadOnly() {
+	if (E.readonly) editorSetStatusMessage("File is opened read-only");
+	else if (E.journal_path && !E.journal) editorSetStatusMessage("Unsaved edits are recovered once the file is loaded");
+	else if (E.filter_pid) editorSetStatusMessage("Rows are being filtered, Ctrl-U cancels it");
+	return E.readonly || (E.journal_path && !E.journal) || E.filter_pid;
+}
+
 void editorInsertChar(int c) {
+	if (editorReadOnly()) return;
+	editorJournalRecord('i', c);
 	if (E.cy == E.numrows) {
 		editorInsertRow(E.numrows, "", 0);
 	}
@@ -357,12 +1004,15 @@ void editorInsertChar(int c) {
 }
 
 void editorInsertNewLine() {
+	if (editorReadOnly()) return;
+	editorJournalRecord('n', 0);
 	if (E.cx == 0) {
 		editorInsertRow(E.cy, "", 0);
 	} else {
 		erow *row = &E.row[E.cy];
 		editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
 		row = &E.row[E.cy];
+		editorRowShiftCheckpoints(row, E.cx, E.cx - row->size);
 		row->size = E.cx;
 		row->chars[row->size] = '\0';
 		editorUpdateRow(row);
@@ -372,13 +1022,15 @@ void editorInsertNewLine() {
 }
 
 void editorDelChars() {
+	if (editorReadOnly()) return;
 	if (E.cy == E.numrows && E.numrows >= 2) return;
 	if (E.cx == 0 && E.cy == 0) return;
+	editorJournalRecord('d', 0);
 	
 	erow *row = &E.row[E.cy];
 	if (E.cx > 0) {
-		editorRowDelChar(row, E.cx - 1);
-		E.cx--;
+		E.cx = utf8Prev(row->chars, E.cx);
+		editorRowDelChar(row, E.cx);
 	} else {
 		E.cx = E.row[E.cy - 1].size;
 		editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
@@ -387,163 +1039,3112 @@ void editorDelChars() {
 	}
 }
 
-
-/*** file i/o ***/
-
-char *editorRowsToString(int *buflen) {
-	int totlen = 0;
-	int j;
-	for (j = 0; j < E.numrows; j++)
-		totlen += E.row[j].size + 1;
-	*buflen = totlen;
+// Inserts text at position x of row y splitting it into rows at newlines. New rows are made at once
+// and get highlighted only once displayed, so pasting a lot of rows costs about as much as loading them.
+void editorInsertText(int y, int x, const char *s, size_t len) {
+	if (editorReadOnly()) return;
+	editorJournalRecordText(y, x, s, len);
+	if (y == E.numrows) editorInsertRow(E.numrows, "", 0);
 	
-	char *buf = malloc(totlen);
-	char *p = buf;
-	for (j = 0; j < E.numrows; j++) {
-		memcpy(p, E.row[j].chars, E.row[j].size);
-		p += E.row[j].size;
-		*p = '\n';
-		p++;
+	int lines = 0;
+	for (const char *p = s; (p = memchr(p, '\n', s + len - p)) != NULL; p++) lines++;
+	erow *row = &E.row[y];
+	if (lines == 0) {
+		editorRowInsertText(row, x, s, len);
+		editorUpdateRow(row);
+		E.dirty++;
+		return;
 	}
 	
-	return buf;
-}
-
-// Open and load file given its name
-void editorOpen(char *filename) {
-	free(E.filename);
-	E.filename = strdup(filename);
+	E.row = realloc(E.row, sizeof(erow) * (E.numrows + lines));
+	row = &E.row[y];
+	memmove(&E.row[y + 1 + lines], &E.row[y + 1], sizeof(erow) * (E.numrows - y - 1));
+	for (int j = y + 1 + lines; j < E.numrows + lines; j++) E.row[j].idx = j;
 	
-	editorSelectSyntaxHighlight();
+	// lines after the first one become new rows, the last one is continued by the rest of the row
+	const char *first = memchr(s, '\n', len);
+	const char *p = first + 1;
+	for (int k = 1; k <= lines; k++) {
+		const char *nl = (k < lines) ? memchr(p, '\n', s + len - p) : s + len;
+		erow *new = &E.row[y + k];
+		editorInitRow(new, y + k, p, nl - p);
+		if (k == lines) editorRowInsertText(new, new->size, &row->chars[x], row->size - x);
+		editorRenderRow(new);
+		p = nl + 1;
+	}
+	editorRowShiftCheckpoints(row, x, x - row->size);
+	row->size = x;
+	row->chars[x] = '\0';
+	editorRowInsertText(row, x, s, first - s);
 	
-	FILE *fp = fopen(filename, "r");
-	if (!fp) { // try to create if doesn't exist
-		fp = fopen(filename, "ab+");
-		fclose(fp);
-		if ((fp = fopen(filename, "r")) == NULL)
-			die("fopen");
+	// the row after the text was highlighted after another one
+	E.numrows += lines;
+	if (y + lines + 1 < E.numrows) {
+		erow *next = &E.row[y + lines + 1];
+		next->hl_valid = 0;
+		if (next->ckpt) next->ckpt_dirty = 1;
 	}
+	E.wrap_dirty = 1;
+	E.offset_dirty = 1;
+	editorDamage(y, INT_MAX);
+	editorUpdateRow(row);
+	E.dirty++;
+	editorModified(y, 1);
+}
 
-	char *line = NULL;
-	size_t linecap = 0;
-	ssize_t linelen;
-	while((linelen = getline(&line, &linecap, fp)) != -1) {
-		while (linelen > 0 && (line[linelen - 1] == '\n' || 
-							   line[linelen - 1] == '\r'))
-			linelen--;
-		editorInsertRow(E.numrows, line, linelen);
+// Deletes len bytes of text from position x of row y on, newlines between rows count as one byte each.
+// Rows in between are dropped at once and the rest of the last row continues the first one.
+void editorDelText(int y, int x, long long len) {
+	if (editorReadOnly() || y >= E.numrows || len <= 0) return;
+	// journal records hold int lengths, deleting the same place again continues a longer deletion
+	for (long long left = len; left > 0; left -= INT_MAX)
+		editorJournalRecordAt('D', y, x, left > INT_MAX ? INT_MAX : left);
+	int y1, x1;
+	editorOffsetLocate(editorRowOffset(y) + x + len, &y1, &x1);
+	erow *row = &E.row[y];
+	if (y1 == y) {
+		editorRowDelText(row, x, x1 - x);
+		editorUpdateRow(row);
+		E.dirty++;
+		return;
 	}
 	
-	free(line);
-	fclose(fp);
-	
-	E.dirty = 0;
+	// rows from..to-1 are dropped, past the end of file the first row goes as well unless it's kept in part
+	int from = y + 1, to = y1 + 1;
+	if (y1 < E.numrows) {
+		erow *last = &E.row[y1];
+		editorRowShiftCheckpoints(row, x, x - row->size);
+		row->size = x;
+		row->chars[x] = '\0';
+		editorRowInsertText(row, x, &last->chars[x1], last->size - x1);
+	} else if (x > 0) {
+		editorRowShiftCheckpoints(row, x, x - row->size);
+		row->size = x;
+		row->chars[x] = '\0';
+		to = E.numrows;
+	} else {
+		from = y;
+		to = E.numrows;
+	}
+	for (int j = from; j < to; j++) editorFreeRow(&E.row[j]);
+	memmove(&E.row[from], &E.row[to], sizeof(erow) * (E.numrows - to));
+	E.numrows -= to - from;
+	for (int j = from; j < E.numrows; j++) E.row[j].idx = j;
+	if (from < E.numrows) {
+		E.row[from].hl_valid = 0;
+		if (E.row[from].ckpt) E.row[from].ckpt_dirty = 1;
+	}
+	E.wrap_dirty = 1;
+	E.offset_dirty = 1;
+	editorDamage(y, INT_MAX);
+	if (from > y) editorUpdateRow(row);
+	E.dirty++;
+	editorModified(y, 1);
 }
 
-void editorSave() {
-	if (E.filename == NULL) {
-		E.filename = editorPrompt("Save as: %s", NULL);
-		if (E.filename == NULL) {
-			editorSetStatusMessage("Save aborted");
-			return;
-		}
-		editorSelectSyntaxHighlight();
+
+/*** multiple cursors ***/
+
+// Besides the cursor at cx & cy a buffer can have extra ones, a keystroke is applied at all of them at once.
+// Edits are grouped by rows, so every touched row is rebuilt, rendered and highlighted only once, and rows
+// are split or joined in a single pass over the rows. Edits are journaled from the last cursor to the
+// first one, so that replaying them one by one doesn't shift positions of the edits still to come.
+
+int editorCursorCompare(const void *a, const void *b) {
+	const struct editorCursor *p = a, *q = b;
+	if (p->cy != q->cy) return p->cy < q->cy ? -1 : 1;
+	return p->cx - q->cx;
+}
+
+// Keeps extra cursors inside of the rows, rows could have changed under them (like after a reload)
+void editorCursorsClamp() {
+	int n = 0;
+	for (int j = 0; j < E.ncursors; j++) {
+		struct editorCursor *c = &E.cursors[j];
+		if (c->cy > E.numrows) continue;
+		int size = c->cy < E.numrows ? E.row[c->cy].size : 0;
+		if (c->cx > size) c->cx = size;
+		E.cursors[n++] = *c;
 	}
-	
-	int len;
-	char *buf = editorRowsToString(&len);
-	int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-	if (fd != -1) {
-		if (ftruncate(fd, len) != -1) {
-			if (write(fd, buf, len) == len) {
-				close(fd);
-				free(buf);
-				editorSetStatusMessage("%d bytes written to disk", len);
-				E.dirty = 0;
-				return;
+	E.ncursors = n;
+}
+
+// Merges cursors of an ordered array which met at the same position, returns how many are left
+int editorCursorsMerge(struct editorCursor *cur, int n) {
+	int m = 0;
+	for (int j = 0; j < n; j++) {
+		if (m > 0 && cur[m - 1].cy == cur[j].cy && cur[m - 1].cx == cur[j].cx) cur[m - 1].primary |= cur[j].primary;
+		else cur[m++] = cur[j];
+	}
+	return m;
+}
+
+// Returns all cursors ordered by position, the one at cx & cy is marked as primary
+int editorCursorsGather(struct editorCursor **cur) {
+	editorCursorsClamp();
+	int n = E.ncursors + 1;
+	*cur = malloc(sizeof(struct editorCursor) * (n + 1)); // room for one more
+	memcpy(*cur, E.cursors, sizeof(struct editorCursor) * E.ncursors);
+	(*cur)[n - 1] = (struct editorCursor){ E.cx, E.cy, 1 };
+	qsort(*cur, n, sizeof(struct editorCursor), editorCursorCompare);
+	return editorCursorsMerge(*cur, n);
+}
+
+// Takes the cursors back from an ordered array
+void editorCursorsScatter(struct editorCursor *cur, int n) {
+	n = editorCursorsMerge(cur, n);
+	E.cursors = realloc(E.cursors, sizeof(struct editorCursor) * n);
+	E.ncursors = 0;
+	for (int j = 0; j < n; j++) {
+		if (cur[j].primary) {
+			E.cx = cur[j].cx;
+			E.cy = cur[j].cy;
+		} else {
+			E.cursors[E.ncursors++] = cur[j];
+		}
+	}
+	free(cur);
+}
+
+// Rows with cursors have to be redrawn whenever the cursors change
+void editorCursorsDamage() {
+	int from = E.cy, to = E.cy;
+	for (int j = 0; j < E.ncursors; j++) {
+		if (E.cursors[j].cy < from) from = E.cursors[j].cy;
+		if (E.cursors[j].cy > to) to = E.cursors[j].cy;
+	}
+	editorDamage(from, to);
+}
+
+// Renders and highlights rows marked in touched. They are marked stale first and highlighted top down,
+// so a change of lexer state spreading down stops at the next one of them instead of highlighting it twice.
+void editorCursorsUpdateRows(const char *touched) {
+	for (int j = 0; j < E.numrows; j++)
+		if (touched[j]) E.row[j].hl_valid = 0;
+	for (int j = 0; j < E.numrows; j++)
+		if (touched[j]) editorUpdateRow(&E.row[j]);
+}
+
+void editorCursorsInsertChar(int c) {
+	if (editorReadOnly()) return;
+	struct editorCursor *cur;
+	int n = editorCursorsGather(&cur);
+	for (int j = n - 1; j >= 0; j--) editorJournalRecordAt('i', cur[j].cy, cur[j].cx, c);
+	if (cur[n - 1].cy == E.numrows) editorInsertRow(E.numrows, "", 0);
+	
+	char *touched = calloc(E.numrows, 1);
+	for (int a = 0, b; a < n; a = b) {
+		erow *row = &E.row[cur[a].cy];
+		for (b = a; b < n && cur[b].cy == cur[a].cy; b++);
+		
+		// text behind each cursor moves right by the number of cursors up to it, from the last one
+		row->chars = realloc(row->chars, row->size + (b - a) + 1);
+		int end = row->size;
+		for (int j = b - 1; j >= a; j--) {
+			int at = cur[j].cx;
+			int shift = j - a + 1;
+			memmove(&row->chars[at + shift], &row->chars[at], end - at);
+			row->chars[at + shift - 1] = c;
+			editorRowShiftCheckpoints(row, at, 1);
+			end = at;
+			cur[j].cx = at + shift;
+		}
+		row->size += b - a;
+		row->chars[row->size] = '\0';
+		touched[row->idx] = 1;
+		editorModified(row->idx, 0);
+	}
+	E.dirty += n;
+	editorCursorsUpdateRows(touched);
+	free(touched);
+	editorCursorsScatter(cur, n);
+}
+
+void editorCursorsInsertNewLine() {
+	if (editorReadOnly()) return;
+	struct editorCursor *cur;
+	int n = editorCursorsGather(&cur);
+	for (int j = n - 1; j >= 0; j--) editorJournalRecordAt('n', cur[j].cy, cur[j].cx, 0);
+	int first = cur[0].cy;
+	
+	// every cursor adds a row, rows are moved to the new array as they are split
+	erow *rows = malloc(sizeof(erow) * (E.numrows + n));
+	char *touched = calloc(E.numrows + n, 1);
+	int w = 0;
+	int j = 0;
+	for (int y = 0; y < E.numrows; y++) {
+		rows[w] = E.row[y];
+		rows[w].idx = w;
+		erow *head = &rows[w++];
+		if (j == n || cur[j].cy != y) continue;
+		
+		// text behind each cursor of the row becomes a new row
+		int k = j;
+		while (k < n && cur[k].cy == y) k++;
+		for (int i = j; i < k; i++) {
+			int from = cur[i].cx;
+			int to = (i + 1 < k) ? cur[i + 1].cx : head->size;
+			editorInitRow(&rows[w], w, &head->chars[from], to - from);
+			touched[w] = 1;
+			cur[i].cy = w++;
+		}
+		int size = cur[j].cx;
+		editorRowShiftCheckpoints(head, size, size - head->size);
+		head->size = size;
+		head->chars[size] = '\0';
+		touched[head->idx] = 1;
+		for (; j < k; j++) cur[j].cx = 0;
+	}
+	if (j < n) { // cursor past the end adds an empty row
+		editorInitRow(&rows[w], w, "", 0);
+		touched[w++] = 1;
+		cur[j].cy = w;
+	}
+	
+	free(E.row);
+	E.row = rows;
+	E.numrows = w;
+	E.wrap_dirty = 1;
+	E.offset_dirty = 1;
+	E.dirty += n;
+	editorModified(first, 1);
+	editorDamage(first, INT_MAX);
+	editorCursorsUpdateRows(touched);
+	free(touched);
+	editorCursorsScatter(cur, n);
+}
+
+// Deletes the character before every cursor, or joins its row with the previous one at the beginning
+// of a row. With forward set the character after the cursor is deleted instead.
+void editorCursorsDelChars(int forward) {
+	if (editorReadOnly()) return;
+	struct editorCursor *cur;
+	int n = editorCursorsGather(&cur);
+	
+	// what every cursor does: 0 nothing, 1 deletes a character, 2 joins its row with the previous one
+	char *action = malloc(n);
+	for (int j = 0; j < n; j++) {
+		struct editorCursor *c = &cur[j];
+		if (forward) {
+			if (c->cy >= E.numrows || (c->cy == E.numrows - 1 && c->cx >= E.row[c->cy].size)) {
+				action[j] = 0;
+				continue;
+			}
+			if (c->cx < E.row[c->cy].size) {
+				c->cx = utf8Next(E.row[c->cy].chars, c->cx, E.row[c->cy].size);
+			} else {
+				c->cy++;
+				c->cx = 0;
+			}
+		}
+		if (c->cy >= E.numrows) action[j] = 0;
+		else if (c->cx > 0) action[j] = 1;
+		else action[j] = c->cy > 0 ? 2 : 0;
+	}
+	int edits = 0;
+	for (int j = n - 1; j >= 0; j--) {
+		if (!action[j]) continue;
+		editorJournalRecordAt('d', cur[j].cy, cur[j].cx, 0);
+		edits++;
+	}
+	
+	// characters before the cursors are cut out of each row in one pass over it
+	int *from = malloc(sizeof(int) * n);
+	char *touched = calloc(E.numrows, 1);
+	for (int a = 0, b; a < n; a = b) {
+		for (b = a; b < n && cur[b].cy == cur[a].cy; b++);
+		int deletes = 0;
+		for (int j = a; j < b; j++) deletes += action[j] == 1;
+		if (!deletes) continue;
+		
+		erow *row = &E.row[cur[a].cy];
+		for (int j = b - 1; j >= a; j--) {
+			if (action[j] != 1) continue;
+			from[j] = utf8Prev(row->chars, cur[j].cx);
+			editorRowShiftCheckpoints(row, from[j], from[j] - cur[j].cx);
+		}
+		int rd = 0, wr = 0;
+		for (int j = a; j < b; j++) {
+			if (action[j] != 1) continue;
+			memmove(&row->chars[wr], &row->chars[rd], from[j] - rd);
+			wr += from[j] - rd;
+			rd = cur[j].cx;
+			cur[j].cx = wr;
+		}
+		memmove(&row->chars[wr], &row->chars[rd], row->size - rd);
+		row->size = wr + row->size - rd;
+		row->chars[row->size] = '\0';
+		touched[row->idx] = 1;
+		editorModified(row->idx, 0);
+	}
+	free(from);
+	
+	// rows are joined while the row array is compacted
+	int first = -1;
+	for (int j = 0; j < n && first == -1; j++)
+		if (action[j] == 2) first = cur[j].cy - 1;
+	if (first != -1) {
+		int w = 0;
+		int j = 0;
+		for (int y = 0; y < E.numrows; y++) {
+			erow *row = &E.row[y];
+			int shift = 0;
+			while (j < n && cur[j].cy < y) j++;
+			if (j < n && cur[j].cy == y && cur[j].cx == 0 && action[j] == 2) {
+				erow *prev = &E.row[w - 1];
+				shift = prev->size;
+				prev->chars = realloc(prev->chars, prev->size + row->size + 1);
+				memcpy(&prev->chars[prev->size], row->chars, row->size + 1);
+				editorRowShiftCheckpoints(prev, prev->size, row->size);
+				prev->size += row->size;
+				touched[w - 1] = 1;
+				editorFreeRow(row);
+			} else {
+				E.row[w] = *row;
+				E.row[w].idx = w;
+				touched[w] = touched[y];
+				w++;
+			}
+			for (int k = j; k < n && cur[k].cy == y; k++) {
+				cur[k].cy = w - 1;
+				cur[k].cx += shift;
+			}
+		}
+		if (cur[n - 1].cy == E.numrows) cur[n - 1].cy = w; // past the end
+		E.numrows = w;
+		E.wrap_dirty = 1;
+		E.offset_dirty = 1;
+		editorModified(first, 1);
+		editorDamage(first, INT_MAX);
+	}
+	
+	E.dirty += edits;
+	editorCursorsUpdateRows(touched);
+	free(touched);
+	free(action);
+	editorCursorsScatter(cur, n);
+}
+
+// Moves every cursor like the cursor is moved by the key
+void editorCursorsMove(int key) {
+	struct editorCursor *cur;
+	int n = editorCursorsGather(&cur);
+	int cx = E.cx, cy = E.cy;
+	for (int j = 0; j < n; j++) {
+		E.cx = cur[j].cx;
+		E.cy = cur[j].cy;
+		if (key == HOME_KEY) E.cx = 0;
+		else if (key == END_KEY) E.cx = E.cy < E.numrows ? E.row[E.cy].size : 0;
+		else editorMoveCursor(key);
+		cur[j].cx = E.cx;
+		cur[j].cy = E.cy;
+	}
+	E.cx = cx;
+	E.cy = cy;
+	qsort(cur, n, sizeof(struct editorCursor), editorCursorCompare);
+	editorCursorsScatter(cur, n);
+}
+
+// Adds a cursor to the row below the last one, at the column of the cursor. The new one becomes
+// the cursor, so the screen follows it.
+void editorCursorsAddBelow() {
+	struct editorCursor *cur;
+	int n = editorCursorsGather(&cur);
+	int y = cur[n - 1].cy + 1;
+	if (y >= E.numrows) {
+		editorCursorsScatter(cur, n);
+		return;
+	}
+	int rx = E.cy < E.numrows ? editorRowCxToRx(&E.row[E.cy], E.cx) : 0;
+	for (int j = 0; j < n; j++) cur[j].primary = 0;
+	cur[n] = (struct editorCursor){ editorRowRxToCx(&E.row[y], rx), y, 1 };
+	editorCursorsScatter(cur, n + 1);
+}
+
+
+/*** clipboard ***/
+
+// Copying doesn't copy the text at first: the clipboard refers to rows of the buffer it was copied from,
+// or to the mapped file in pager mode, and gets its own copy of the text only before those rows get edited
+// or dropped. So copying even a huge part of a file is instant and takes no memory.
+
+struct editorClipboard {
+	char *text; // text owned by the clipboard, NULL while it's only referred to
+	size_t len;
+	int mode; // mode of the selection the text was copied from, rectangles have a row of text per line
+	int buffer; // id of the buffer whose rows hold the text, -1 if the text isn't in rows
+	int y0, x0, y1, x1; // where the text is in the rows, x0 and x1 are rendered columns of rectangles
+	const char *data; // the text in a mapped file, it's never modified
+	void *map; // mapped file the text is in once its buffer was closed
+	size_t map_size;
+};
+
+struct editorClipboard clipboard = { NULL, 0, 0, -1, 0, 0, 0, 0, NULL, NULL, 0 };
+int osc52 = 0; // whether copied text is sent to the terminal's clipboard as well
+
+// Copies text from position x0 of row y0 to position x1 of row y1, rows are ended by newlines
+char *editorRangeToString(int y0, int x0, int y1, int x1, size_t *len) {
+	*len = editorRowOffset(y1) + x1 - editorRowOffset(y0) - x0;
+	char *buf = malloc(*len + 1);
+	char *p = buf;
+	for (int y = y0; y <= y1 && y < E.numrows; y++) {
+		int from = (y == y0) ? x0 : 0;
+		int to = (y == y1) ? x1 : E.row[y].size;
+		memcpy(p, &E.row[y].chars[from], to - from);
+		p += to - from;
+		if (y < y1) *p++ = '\n';
+	}
+	return buf;
+}
+
+// Copies a rectangle of columns rx0 to rx1, every row of it is ended by a newline
+char *editorBlockToString(int y0, int y1, int rx0, int rx1, size_t *len) {
+	if (y1 >= E.numrows) y1 = E.numrows - 1;
+	int *from = malloc(sizeof(int) * 2 * (y1 - y0 + 1));
+	*len = 0;
+	for (int y = y0; y <= y1; y++) {
+		int *span = &from[2 * (y - y0)];
+		span[0] = editorRowRxToCx(&E.row[y], rx0);
+		span[1] = editorRowRxToCx(&E.row[y], rx1);
+		*len += span[1] - span[0] + 1;
+	}
+	char *buf = malloc(*len + 1);
+	char *p = buf;
+	for (int y = y0; y <= y1; y++) {
+		int *span = &from[2 * (y - y0)];
+		memcpy(p, &E.row[y].chars[span[0]], span[1] - span[0]);
+		p += span[1] - span[0];
+		*p++ = '\n';
+	}
+	free(from);
+	return buf;
+}
+
+// Copies the text the clipboard refers to out of rows of the active buffer
+char *editorClipboardCopyRows(size_t *len) {
+	if (clipboard.mode == 'r') return editorBlockToString(clipboard.y0, clipboard.y1, clipboard.x0, clipboard.x1, len);
+	return editorRangeToString(clipboard.y0, clipboard.x0, clipboard.y1, clipboard.x1, len);
+}
+
+// Gives the clipboard its own copy of the text it refers to in rows
+void editorClipboardOwn() {
+	if (clipboard.buffer == -1) return;
+	clipboard.text = editorClipboardCopy();
+	clipboard.buffer = -1;
+}
+
+// Rows from y on are about to change, text of the clipboard in them has to be copied first
+void editorClipboardEdit(int y) {
+	if (clipboard.buffer == E.id && y <= clipboard.y1) editorClipboardOwn();
+}
+
+// The active buffer is closed, text of the clipboard in it is copied and the mapped file is kept
+void editorClipboardRelease() {
+	if (clipboard.buffer == E.id) editorClipboardOwn();
+	if (clipboard.data && E.pager && clipboard.data >= E.pager_data && clipboard.data <= E.pager_data + E.pager_size) {
+		clipboard.map = (void *)E.pager_data;
+		clipboard.map_size = E.pager_size;
+		E.pager_data = NULL;
+	}
+}
+
+void editorClipboardClear() {
+	free(clipboard.text);
+	if (clipboard.map) munmap(clipboard.map, clipboard.map_size);
+	clipboard = (struct editorClipboard){ NULL, 0, 0, -1, 0, 0, 0, 0, NULL, NULL, 0 };
+}
+
+// Text of the clipboard in one piece. Text in rows of another buffer is copied for the caller to free
+// in *copy, text in the active buffer is copied to the clipboard as it's going to be edited.
+const char *editorClipboardText(char **copy) {
+	*copy = NULL;
+	if (clipboard.buffer == E.id) editorClipboardOwn();
+	if (clipboard.text) return clipboard.text;
+	if (clipboard.data) return clipboard.data;
+	if (clipboard.buffer != -1) return *copy = editorClipboardCopy();
+	return NULL;
+}
+
+const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Sends small copied text to the clipboard of the terminal with an OSC 52 sequence, it's how copying works
+// over ssh. Terminals limit how much they take, so bigger text isn't sent.
+void editorClipboardExport() {
+	if (!osc52 || clipboard.len == 0 || clipboard.len > HECTO_OSC52_MAX) return;
+	char *copy = (clipboard.buffer != -1) ? editorClipboardCopy() : NULL;
+	const unsigned char *s = (const unsigned char *)(copy ? copy : clipboard.text ? clipboard.text : clipboard.data);
+	size_t len = clipboard.len;
+	char *seq = malloc(4 * (len + 2) / 3 + 16);
+	char *p = seq + sprintf(seq, "\x1b]52;c;");
+	for (size_t i = 0; i < len; i += 3) {
+		unsigned int v = s[i] << 16 | (i + 1 < len ? s[i + 1] << 8 : 0) | (i + 2 < len ? s[i + 2] : 0);
+		*p++ = base64[v >> 18];
+		*p++ = base64[(v >> 12) & 63];
+		*p++ = i + 1 < len ? base64[(v >> 6) & 63] : '=';
+		*p++ = i + 2 < len ? base64[v & 63] : '=';
+	}
+	*p++ = '\a';
+	if (write(STDOUT_FILENO, seq, p - seq) == -1) {} // the terminal's clipboard is only a convenience
+	free(seq);
+	free(copy);
+}
+
+
+/*** selection ***/
+
+// Text is selected from where the selection was started to the cursor: a stream of characters, whole rows
+// or a rectangle of columns. Selections are copied to the clipboard shared by all buffers. Edits are made
+// on whole ranges, so rows in between are moved at once and every other row is reallocated at most once.
+
+// Starts a selection at the cursor, starting it again switches between stream, line and rectangle selection
+void editorSelectStart() {
+	const char *next = (E.sel_mode == 0) ? "s" : (E.sel_mode == 's') ? "l" : (E.sel_mode == 'l') ? "r" : "";
+	if (E.sel_mode == 0) {
+		E.sel_cx = E.cx;
+		E.sel_cy = E.cy;
+		E.ncursors = 0;
+	}
+	E.sel_mode = *next;
+	if (E.sel_mode == 's') editorSetStatusMessage("Selecting text (Ctrl-C = copy | Ctrl-X = cut | Ctrl-Space = rows)");
+	else if (E.sel_mode == 'l') editorSetStatusMessage("Selecting rows (Ctrl-Space = rectangle)");
+	else if (E.sel_mode == 'r') editorSetStatusMessage("Selecting rectangle (typing edits all of its rows)");
+	else editorSetStatusMessage("");
+}
+
+// Selection ends were left past the rows by an edit of another window or a reload
+void editorSelectionClamp() {
+	if (E.sel_cy > E.numrows) E.sel_cy = E.numrows;
+	int size = E.sel_cy < E.numrows ? E.row[E.sel_cy].size : 0;
+	if (E.sel_cx > size) E.sel_cx = size;
+}
+
+// Where a stream or line selection starts and ends, lines end at the start of the row after the last one
+void editorSelectionRange(int *y0, int *x0, int *y1, int *x1) {
+	editorSelectionClamp();
+	int before = E.sel_cy < E.cy || (E.sel_cy == E.cy && E.sel_cx < E.cx);
+	*y0 = before ? E.sel_cy : E.cy;
+	*x0 = before ? E.sel_cx : E.cx;
+	*y1 = before ? E.cy : E.sel_cy;
+	*x1 = before ? E.cx : E.sel_cx;
+	if (E.sel_mode == 'l') {
+		*x0 = 0;
+		*x1 = 0;
+		if (*y1 < E.numrows) (*y1)++;
+	}
+}
+
+// Rows and rendered columns rx0 to rx1 of a rectangle selection
+void editorSelectionBlock(int *y0, int *y1, int *rx0, int *rx1) {
+	editorSelectionClamp();
+	int ra = E.sel_cy < E.numrows ? editorRowCxToRx(&E.row[E.sel_cy], E.sel_cx) : 0;
+	int rb = E.cy < E.numrows ? editorRowCxToRx(&E.row[E.cy], E.cx) : 0;
+	*y0 = E.sel_cy < E.cy ? E.sel_cy : E.cy;
+	*y1 = E.sel_cy < E.cy ? E.cy : E.sel_cy;
+	*rx0 = ra < rb ? ra : rb;
+	*rx1 = ra < rb ? rb : ra;
+}
+
+// Rendered columns of the row which are selected, returns 0 if there are none
+int editorSelectionColumns(erow *row, int *from, int *to) {
+	if (E.sel_mode == 'r') {
+		int y0, y1;
+		editorSelectionBlock(&y0, &y1, from, to);
+		return row->idx >= y0 && row->idx <= y1 && *from < *to;
+	}
+	int y0, x0, y1, x1;
+	editorSelectionRange(&y0, &x0, &y1, &x1);
+	if (row->idx < y0 || row->idx > y1 || (row->idx == y1 && x1 == 0)) return 0;
+	*from = (row->idx == y0) ? editorRowCxToRx(row, x0) : 0;
+	*to = (row->idx == y1) ? editorRowCxToRx(row, x1) : row->rwidth;
+	return *from < *to;
+}
+
+// Rows of the selection have to be redrawn whenever either of its ends moves
+void editorSelectionDamage() {
+	int from = E.sel_cy < E.cy ? E.sel_cy : E.cy;
+	int to = E.sel_cy < E.cy ? E.cy : E.sel_cy;
+	editorDamage(from, to);
+}
+
+void editorSelectionCopy() {
+	if (!E.sel_mode) {
+		editorSetStatusMessage("Nothing is selected (Ctrl-Space = select)");
+		return;
+	}
+	editorClipboardClear();
+	clipboard.mode = E.sel_mode;
+	if (E.sel_mode == 'r') {
+		editorSelectionBlock(&clipboard.y0, &clipboard.y1, &clipboard.x0, &clipboard.x1);
+		if (clipboard.y1 >= E.numrows) clipboard.y1 = E.numrows - 1;
+		for (int y = clipboard.y0; y <= clipboard.y1; y++)
+			clipboard.len += editorRowRxToCx(&E.row[y], clipboard.x1) - editorRowRxToCx(&E.row[y], clipboard.x0) + 1;
+	} else {
+		editorSelectionRange(&clipboard.y0, &clipboard.x0, &clipboard.y1, &clipboard.x1);
+		clipboard.len = editorRowOffset(clipboard.y1) + clipboard.x1 - editorRowOffset(clipboard.y0) - clipboard.x0;
+	}
+	
+	// rows in pager mode are only a window of the mapped file, which holds the text as it is in the file
+	if (E.pager && E.sel_mode != 'r') {
+		off_t from = E.pager_offs[clipboard.y0] + clipboard.x0;
+		clipboard.data = E.pager_data + from;
+		clipboard.len = E.pager_offs[clipboard.y1] + clipboard.x1 - from;
+	} else if (E.pager) {
+		clipboard.text = editorClipboardCopyRows(&clipboard.len);
+	} else {
+		clipboard.buffer = E.id;
+	}
+	editorClipboardExport();
+	editorSetStatusMessage("Copied %zu bytes", clipboard.len);
+}
+
+// Copies the selection and ends it
+void editorSelectionCopyEnd() {
+	editorSelectionCopy();
+	E.sel_mode = 0;
+}
+
+// Deletes columns rx0 to rx1 of rows y0 to y1, every row is edited in place
+void editorBlockDelete(int y0, int y1, int rx0, int rx1) {
+	char *touched = calloc(E.numrows, 1);
+	int edits = 0;
+	for (int y = y0; y <= y1 && y < E.numrows; y++) {
+		erow *row = &E.row[y];
+		int from = editorRowRxToCx(row, rx0);
+		int to = editorRowRxToCx(row, rx1);
+		if (from >= to) continue;
+		editorJournalRecordAt('D', y, from, to - from);
+		editorRowDelText(row, from, to - from);
+		touched[y] = 1;
+		edits++;
+	}
+	E.dirty += edits;
+	editorCursorsUpdateRows(touched);
+	free(touched);
+}
+
+// Deletes the selected text, the cursor is left where it started
+void editorSelectionDelete() {
+	if (editorReadOnly()) return;
+	if (E.sel_mode == 'r') {
+		int y0, y1, rx0, rx1;
+		editorSelectionBlock(&y0, &y1, &rx0, &rx1);
+		editorBlockDelete(y0, y1, rx0, rx1);
+		E.cy = y0;
+		E.cx = y0 < E.numrows ? editorRowRxToCx(&E.row[y0], rx0) : 0;
+	} else {
+		int y0, x0, y1, x1;
+		editorSelectionRange(&y0, &x0, &y1, &x1);
+		editorDelText(y0, x0, editorRowOffset(y1) + x1 - editorRowOffset(y0) - x0);
+		E.cy = y0;
+		E.cx = x0;
+	}
+	E.sel_mode = 0;
+}
+
+void editorSelectionCut() {
+	if (!E.sel_mode) {
+		editorSetStatusMessage("Nothing is selected (Ctrl-Space = select)");
+		return;
+	}
+	if (editorReadOnly()) return;
+	editorSelectionCopy();
+	editorSelectionDelete();
+}
+
+// Puts a cursor at rendered column rx of every row from y0 to y1, so typing edits all of them
+void editorBlockCursors(int y0, int y1, int rx) {
+	if (y1 >= E.numrows) y1 = E.numrows - 1;
+	if (y1 < y0) return;
+	struct editorCursor *cur = malloc(sizeof(struct editorCursor) * (y1 - y0 + 1));
+	for (int y = y0; y <= y1; y++)
+		cur[y - y0] = (struct editorCursor){ editorRowRxToCx(&E.row[y], rx), y, y == E.cy };
+	editorCursorsScatter(cur, y1 - y0 + 1);
+}
+
+// Inserts lines of a rectangle into rows from the cursor down at the cursor's column. Rows too short are
+// padded with spaces and missing ones are added at the end of file.
+void editorBlockPaste(const char *s, size_t len) {
+	int rx = E.cy < E.numrows ? editorRowCxToRx(&E.row[E.cy], E.cx) : 0;
+	int lines = 0;
+	for (const char *p = s; (p = memchr(p, '\n', s + len - p)) != NULL; p++) lines++;
+	int missing = E.cy + lines - E.numrows;
+	if (missing > 0) {
+		char *nl = malloc(missing);
+		memset(nl, '\n', missing);
+		if (E.numrows > 0) editorInsertText(E.numrows - 1, E.row[E.numrows - 1].size, nl, missing);
+		else editorInsertText(0, 0, nl, missing - 1);
+		free(nl);
+	}
+	
+	char *touched = calloc(E.numrows, 1);
+	char *piece = NULL;
+	const char *p = s;
+	for (int y = E.cy; y < E.cy + lines; y++) {
+		const char *nl = memchr(p, '\n', s + len - p);
+		erow *row = &E.row[y];
+		int pad = rx - row->rwidth;
+		if (pad < 0) pad = 0;
+		piece = realloc(piece, pad + (nl - p));
+		memset(piece, ' ', pad);
+		memcpy(piece + pad, p, nl - p);
+		int at = pad ? row->size : editorRowRxToCx(row, rx);
+		if (pad + (nl - p) > 0) {
+			editorJournalRecordText(y, at, piece, pad + (nl - p));
+			editorRowInsertText(row, at, piece, pad + (nl - p));
+			touched[y] = 1;
+			E.dirty++;
+		}
+		p = nl + 1;
+	}
+	free(piece);
+	editorCursorsUpdateRows(touched);
+	free(touched);
+}
+
+// Pastes the clipboard at the cursor, replacing the selection if there's one
+void editorPaste() {
+	if (!clipboard.text && !clipboard.data && clipboard.buffer == -1) {
+		editorSetStatusMessage("Clipboard is empty (Ctrl-C = copy)");
+		return;
+	}
+	if (editorReadOnly()) return;
+	if (E.sel_mode) editorSelectionDelete();
+	E.ncursors = 0;
+	
+	char *copy;
+	const char *text = editorClipboardText(&copy);
+	if (clipboard.mode == 'r') {
+		editorBlockPaste(text, clipboard.len);
+	} else if (clipboard.mode == 'l') {
+		// rows are pasted above the cursor's row, after the last row there's no newline to end them with
+		size_t len = clipboard.len - (E.cy == E.numrows);
+		if (len > 0) editorInsertText(E.cy, 0, text, len);
+		E.cx = 0;
+	} else {
+		long long end = editorRowOffset(E.cy) + E.cx + clipboard.len;
+		editorInsertText(E.cy, E.cx, text, clipboard.len);
+		editorOffsetLocate(end, &E.cy, &E.cx);
+	}
+	free(copy);
+}
+
+// Applies a key editing text to the selection. Typed text replaces the selected one, a rectangle turns
+// into cursors on all of its rows instead. Returns whether the key was used up.
+int editorSelectionEdit(int c) {
+	int del = (c == BACKSPACE || c == CTRL_KEY('h') || c == DEL_KEY);
+	if (!del && c != '\r' && c != '\t' && ((c >= 0 && c < ' ') || c >= ARROW_LEFT)) return 0;
+	if (editorReadOnly()) return 1;
+	if (E.sel_mode == 'r') {
+		int y0, y1, rx0, rx1;
+		editorSelectionBlock(&y0, &y1, &rx0, &rx1);
+		E.sel_mode = 0;
+		if (rx0 < rx1) {
+			editorBlockDelete(y0, y1, rx0, rx1);
+			if (del) {
+				E.cx = E.cy < E.numrows ? editorRowRxToCx(&E.row[E.cy], rx0) : 0;
+				return 1;
+			}
+		}
+		E.cx = E.cy < E.numrows ? editorRowRxToCx(&E.row[E.cy], rx0) : 0;
+		editorBlockCursors(y0, y1, rx0);
+		return 0;
+	}
+	editorSelectionDelete();
+	return del;
+}
+
+
+/*** compression ***/
+
+// Picks codec of the file by its extension
+void editorSelectCodec() {
+	E.codec = NULL;
+	if (E.filename == NULL) return;
+	
+	size_t len = strlen(E.filename);
+	for (unsigned int j = 0; j < CODECDB_ENTRIES; j++) {
+		size_t elen = strlen(CODECDB[j].extension);
+		if (len > elen && !strcmp(&E.filename[len - elen], CODECDB[j].extension)) {
+			E.codec = &CODECDB[j];
+			return;
+		}
+	}
+}
+
+// Runs a codec program with given descriptors as its stdin and stdout, returns its pid or -1
+pid_t editorCodecSpawn(char **argv, int in, int out) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		if (dup2(in, STDIN_FILENO) == -1 || dup2(out, STDOUT_FILENO) == -1) _exit(127);
+		sigset_t set;
+		sigemptyset(&set);
+		sigprocmask(SIG_SETMASK, &set, NULL);
+		signal(SIGPIPE, SIG_DFL); // the editor ignores it, programs expect to be killed by it
+		setpgid(0, 0); // stopped together with programs it runs
+		int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		if (null != -1) dup2(null, STDERR_FILENO); // it would mess up the screen
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	return pid;
+}
+
+// Reads decompressed data in blocks as it comes, appending it as new rows
+void editorCodecHandler(int fd) {
+	static char buf[HECTO_CODEC_BLOCK];
+	ssize_t nread = 0;
+	size_t len = 0;
+	while (len < sizeof(buf) && (nread = read(fd, buf + len, sizeof(buf) - len)) > 0) len += nread;
+	if (len > 0) editorAppendText(buf, len, &E.codec_open_row);
+	if (nread == -1 && (errno == EAGAIN || errno == EINTR)) return;
+	if (len == sizeof(buf)) return;
+	
+	// end of data
+	editorRemoveWatch(fd);
+	close(fd);
+	E.codec_fd = -1;
+	int status;
+	if (waitpid(E.codec_pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		E.readonly = 1; // saving would overwrite the file with what was read so far
+		editorSetStatusMessage("Can't decompress file with %s, opened read-only", E.codec->name);
+		return;
+	}
+	editorJournalStart();
+}
+
+// Starts decompressing the file in the background, rows show up as they get decompressed
+int editorCodecOpen(char *filename) {
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return (errno == ENOENT) ? 0 : -1; // new file is compressed once saved
+	
+	int p[2];
+	if (pipe2(p, O_CLOEXEC) == -1) die("pipe2");
+	E.codec_pid = editorCodecSpawn(E.codec->decompress, fd, p[1]);
+	close(fd);
+	close(p[1]);
+	if (E.codec_pid == -1) {
+		close(p[0]);
+		return -1;
+	}
+	
+	fcntl(p[0], F_SETFL, O_NONBLOCK);
+	E.codec_fd = p[0];
+	E.codec_open_row = 0;
+	editorAddWatch(E.codec_fd, editorCodecHandler);
+	return 0;
+}
+
+// Compresses buffer into the file, replacing it only once the codec succeeds
+int editorCodecSave(struct editorSave *save) {
+	size_t tlen = strlen(save->filename) + 8;
+	char *tmp = malloc(tlen);
+	snprintf(tmp, tlen, "%s.tmp~", save->filename);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		free(tmp);
+		return -1;
+	}
+	
+	struct stat st;
+	if (stat(save->filename, &st) == 0) fchmod(fd, st.st_mode & 07777);
+	
+	int p[2];
+	if (pipe2(p, O_CLOEXEC) == -1) die("pipe2");
+	pid_t pid = editorCodecSpawn(save->codec->compress, p[0], fd);
+	close(p[0]);
+	close(fd);
+	
+	int written = pid != -1 && editorSaveWrite(save, p[1]) == 0;
+	close(p[1]);
+	
+	int status = -1;
+	if (pid != -1 && waitpid(pid, &status, 0) == -1) status = -1;
+	int ok = written && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	if (ok && rename(tmp, save->filename) == 0) {
+		free(tmp);
+		return 0;
+	}
+	int err = errno;
+	unlink(tmp);
+	free(tmp);
+	errno = ok ? err : EIO;
+	return -1;
+}
+
+
+/*** filter ***/
+
+// Rows are filtered through a shell command (like sort or jq) running alongside the editor. The
+// rows are written to the command as fast as it reads them while its output is read at the same
+// time, so a command which writes before reading all of its input never blocks. The output goes
+// straight into new rows in front of the row after the filtered ones, which replace the filtered
+// rows once the command succeeds or get dropped if it fails. The buffer can't be edited meanwhile.
+
+// Writes the filtered rows to the command, each followed by a newline
+void editorFilterWrite(int fd) {
+	while (E.filter_y < E.filter_end) {
+		struct iovec iov[HECTO_FILTER_ROWS * 2];
+		int n = 0;
+		for (int y = E.filter_y; y < E.filter_end && n < HECTO_FILTER_ROWS * 2; y++) {
+			erow *row = &E.row[y];
+			int x = (y == E.filter_y) ? E.filter_x : 0;
+			if (x < row->size) iov[n++] = (struct iovec){ &row->chars[x], row->size - x };
+			iov[n++] = (struct iovec){ "\n", 1 };
+		}
+		ssize_t written = writev(fd, iov, n);
+		if (written == -1 && (errno == EAGAIN || errno == EINTR)) return;
+		if (written == -1) break; // the command doesn't read any more
+		
+		// newline of the row is written once filter_x gets past its size
+		while (written > 0) {
+			int left = E.row[E.filter_y].size - E.filter_x + 1;
+			if (written < left) {
+				E.filter_x += written;
+				break;
+			}
+			written -= left;
+			E.filter_y++;
+			E.filter_x = 0;
+		}
+	}
+	
+	// the command sees the end of its input
+	editorRemoveWatch(fd);
+	close(fd);
+	E.filter_in = -1;
+}
+
+// Inserts a part of the output where the previous one ended
+void editorFilterInsert(const char *s, size_t len) {
+	if (len == 0) return;
+	// the output is the only edit made while filtering
+	pid_t pid = E.filter_pid;
+	E.filter_pid = 0;
+	editorInsertText(E.filter_oy, E.filter_ox, s, len);
+	E.filter_pid = pid;
+	E.filter_len += len;
+	editorOffsetLocate(editorRowOffset(E.filter_end) + E.filter_len, &E.filter_oy, &E.filter_ox);
+}
+
+// Closes the pipes and waits for the command, returns whether it succeeded
+int editorFilterStop(int cancel) {
+	if (E.filter_in != -1) {
+		editorRemoveWatch(E.filter_in);
+		close(E.filter_in);
+		E.filter_in = -1;
+	}
+	editorRemoveWatch(E.filter_out);
+	close(E.filter_out);
+	E.filter_out = -1;
+	if (cancel) kill(-E.filter_pid, SIGTERM); // the shell and commands it started
+	int status = 0;
+	int waited = waitpid(E.filter_pid, &status, 0) != -1;
+	int err = errno;
+	int ok = waited && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	E.filter_pid = 0;
+	if (!ok && !cancel) {
+		if (!waited) editorSetStatusMessage("Can't wait for command: %s, rows were kept", strerror(err));
+		else if (WIFEXITED(status)) editorSetStatusMessage("Command failed with status %d, rows were kept", WEXITSTATUS(status));
+		else editorSetStatusMessage("Command was killed, rows were kept");
+	}
+	return ok && !cancel;
+}
+
+// Replaces the filtered rows with the output, or drops the output when the command failed
+void editorFilterEnd(int ok) {
+	if (!ok) {
+		// past the end of file the output started a new row
+		if (E.filter_len > 0) editorDelText(E.filter_end, 0, E.filter_len + E.filter_eof);
+	} else {
+		int rows = E.filter_end - E.filter_start;
+		// the output ends with a newline in front of the rows after it, but not at the end of file
+		if (!E.filter_eof && (E.filter_len > 0 || E.filter_nl)) editorInsertText(E.filter_oy, E.filter_ox, "\n", 1);
+		editorDelText(E.filter_start, 0, editorRowOffset(E.filter_end) - editorRowOffset(E.filter_start));
+		E.cy = E.filter_start;
+		E.cx = 0;
+		editorSetStatusMessage("Filtered %d rows", rows);
+	}
+	if (E.cy > E.numrows) E.cy = E.numrows;
+	int size = E.cy < E.numrows ? E.row[E.cy].size : 0;
+	if (E.cx > size) E.cx = size;
+}
+
+// Inserts the output as it comes, a newline at its end is held back so it doesn't make an empty row
+void editorFilterRead(int fd) {
+	static char buf[HECTO_CODEC_BLOCK + 1]; // room for the held back newline in front
+	ssize_t nread = 0;
+	size_t len = 0;
+	while (len < HECTO_CODEC_BLOCK && (nread = read(fd, buf + 1 + len, HECTO_CODEC_BLOCK - len)) > 0) len += nread;
+	if (len > 0) {
+		char *s = buf + 1;
+		size_t slen = len;
+		if (E.filter_nl) {
+			*--s = '\n';
+			slen++;
+		}
+		E.filter_nl = s[slen - 1] == '\n';
+		editorFilterInsert(s, slen - E.filter_nl);
+	}
+	if (nread == -1 && (errno == EAGAIN || errno == EINTR)) return;
+	if (len == HECTO_CODEC_BLOCK) return;
+	
+	// end of output
+	editorFilterEnd(editorFilterStop(0));
+}
+
+// Asks for a command and filters the selected rows through it, or the whole file when nothing is
+// selected. Pressed again while filtering it cancels the command.
+void editorFilter() {
+	if (E.filter_pid) {
+		editorFilterStop(1);
+		editorFilterEnd(0);
+		editorSetStatusMessage("Filtering cancelled");
+		return;
+	}
+	if (editorReadOnly()) return;
+	if (E.follow || E.codec_fd != -1) {
+		editorSetStatusMessage("Can't filter while the file is being %s", E.follow ? "followed" : "decompressed");
+		return;
+	}
+	
+	int start = 0, end = E.numrows;
+	if (E.sel_mode == 'r') {
+		int rx0, rx1;
+		editorSelectionBlock(&start, &end, &rx0, &rx1);
+		end++;
+	} else if (E.sel_mode) {
+		int x0, x1;
+		editorSelectionRange(&start, &x0, &end, &x1);
+		if (x1 > 0 || end == start) end++; // a row is filtered whole once any of it is selected
+	}
+	if (end > E.numrows) end = E.numrows;
+	
+	char *cmd = editorPrompt("Filter rows through: %s (ESC to cancel)", NULL);
+	if (cmd == NULL) return;
+	E.sel_mode = 0;
+	E.ncursors = 0;
+	
+	int in[2], out[2];
+	if (pipe2(in, O_CLOEXEC) == -1 || pipe2(out, O_CLOEXEC) == -1) die("pipe2");
+	char *argv[] = { "/bin/sh", "-c", cmd, NULL };
+	pid_t pid = editorCodecSpawn(argv, in[0], out[1]);
+	close(in[0]);
+	close(out[1]);
+	free(cmd);
+	if (pid == -1) {
+		close(in[1]);
+		close(out[0]);
+		editorSetStatusMessage("Can't run command: %s", strerror(errno));
+		return;
+	}
+	
+	fcntl(in[1], F_SETFL, O_NONBLOCK);
+	fcntl(out[0], F_SETFL, O_NONBLOCK);
+	E.filter_pid = pid;
+	E.filter_in = in[1];
+	E.filter_out = out[0];
+	E.filter_start = start;
+	E.filter_end = end;
+	E.filter_eof = end == E.numrows;
+	E.filter_y = start;
+	E.filter_x = 0;
+	E.filter_oy = end;
+	E.filter_ox = 0;
+	E.filter_len = 0;
+	E.filter_nl = 0;
+	editorAddWriteWatch(E.filter_in, editorFilterWrite);
+	editorAddWatch(E.filter_out, editorFilterRead);
+	editorSetStatusMessage("Filtering %d rows, Ctrl-U cancels it", end - start);
+}
+
+
+/*** file i/o ***/
+
+// Concatenates rows from..to-1, they are also what the file holds once it's saved
+char *editorRowsToString(int from, int to, int *buflen) {
+	int totlen = 0;
+	int j;
+	for (j = from; j < to; j++)
+		totlen += E.row[j].size + 1;
+	*buflen = totlen;
+	
+	char *buf = malloc(totlen);
+	char *p = buf;
+	for (j = from; j < to; j++) {
+		memcpy(p, E.row[j].chars, E.row[j].size);
+		p += E.row[j].size;
+		*p = '\n';
+		p++;
+		E.row[j].saved_size = E.row[j].size;
+	}
+	
+	return buf;
+}
+
+// Part of a file split into rows by one of the loading threads
+struct editorLoadChunk {
+	const char *start;
+	const char *end;
+	erow *rows;
+	int nrows;
+	int crlf; // whether carriage returns were stripped
+	pthread_t thread;
+	int threaded; // whether the chunk got its own thread
+};
+
+// Splits the chunk into rows and renders them, trailing newlines and carriage returns are stripped
+void *editorLoadChunk(void *arg) {
+	struct editorLoadChunk *chunk = arg;
+	const char *p = chunk->start;
+	const char *end = chunk->end;
+	
+	int lines = 0;
+	for (const char *q = p; q < end && (q = memchr(q, '\n', end - q)) != NULL; q++) lines++;
+	chunk->rows = malloc(sizeof(erow) * (lines + 1));
+	chunk->nrows = 0;
+	chunk->crlf = 0;
+	
+	while (p < end) {
+		const char *nl = memchr(p, '\n', end - p);
+		const char *next = nl ? nl + 1 : end;
+		size_t linelen = next - p;
+		while (linelen > 0 && (p[linelen - 1] == '\n' || p[linelen - 1] == '\r')) linelen--;
+		if (linelen < (size_t)(next - p) - (nl ? 1 : 0)) chunk->crlf = 1;
+		
+		erow *row = &chunk->rows[chunk->nrows];
+		editorInitRow(row, chunk->nrows, p, linelen);
+		editorRenderRow(row);
+		chunk->nrows++;
+		p = next;
+	}
+	return NULL;
+}
+
+// Loads rows of the mapped file splitting it into chunks handled by a pool of threads, rows of
+// every chunk are then moved into the row table in order
+void editorLoad(const char *data, size_t size) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int nchunks = size / HECTO_LOAD_CHUNK + 1;
+	if (nchunks > cpus) nchunks = cpus > 0 ? cpus : 1;
+	if (nchunks > HECTO_LOAD_THREADS) nchunks = HECTO_LOAD_THREADS;
+	
+	// chunks end right after a newline, so no line is split between them
+	struct editorLoadChunk chunks[HECTO_LOAD_THREADS];
+	const char *p = data;
+	const char *end = data + size;
+	int n = 0;
+	while (n < nchunks && p < end) {
+		const char *cut = (n == nchunks - 1) ? end : p + (end - p) / (nchunks - n);
+		if (cut < end) {
+			const char *nl = memchr(cut, '\n', end - cut);
+			cut = nl ? nl + 1 : end;
+		}
+		chunks[n].start = p;
+		chunks[n].end = cut;
+		p = cut;
+		n++;
+	}
+	
+	// the first chunk is done by the main thread, which also covers the case of failed thread creation
+	for (int j = 1; j < n; j++)
+		chunks[j].threaded = pthread_create(&chunks[j].thread, NULL, editorLoadChunk, &chunks[j]) == 0;
+	if (n > 0) editorLoadChunk(&chunks[0]);
+	for (int j = 1; j < n; j++) {
+		if (chunks[j].threaded) pthread_join(chunks[j].thread, NULL);
+		else editorLoadChunk(&chunks[j]);
+	}
+	
+	int total = 0;
+	for (int j = 0; j < n; j++) total += chunks[j].nrows;
+	editorDamage(E.numrows, INT_MAX);
+	E.row = realloc(E.row, sizeof(erow) * (E.numrows + total));
+	for (int j = 0; j < n; j++) {
+		for (int k = 0; k < chunks[j].nrows; k++) chunks[j].rows[k].idx = E.numrows + k;
+		memcpy(&E.row[E.numrows], chunks[j].rows, sizeof(erow) * chunks[j].nrows);
+		E.numrows += chunks[j].nrows;
+		E.crlf |= chunks[j].crlf;
+		free(chunks[j].rows);
+	}
+	E.wrap_dirty = 1;
+	E.offset_dirty = 1;
+}
+
+// Whether the rows joined by newlines are the file on disk byte for byte. They aren't once carriage
+// returns were stripped, then changed parts of the file can't be written in place until a full save.
+int editorDiskMatches(off_t size) {
+	if (E.crlf) return 0;
+	long long total = editorRowOffset(E.numrows);
+	return total == size || (E.numrows > 0 && total - 1 == size);
+}
+
+// Open and load file given its name
+void editorOpen(char *filename) {
+	free(E.filename);
+	E.filename = strdup(filename);
+	E.syntax = NULL;
+	E.crlf = 0;
+	
+	// compressed files are decompressed in the background
+	editorSelectCodec();
+	if (E.codec) {
+		E.pager = 0;
+		if (editorCodecOpen(filename) == -1) die("editorCodecOpen");
+		editorSelectSyntaxHighlight();
+		E.dirty = 0;
+		if (stat(filename, &E.disk_stat) == 0) editorDiskWatch(); // watched, but never written in place
+		editorJournalStart();
+		return;
+	}
+	
+	// files too big to be loaded are only viewed
+	struct stat st;
+	if (E.pager || (stat(filename, &st) == 0 && st.st_size >= HECTO_PAGER_SIZE)) {
+		editorSelectSyntaxHighlight(); // the index thread needs syntax to find comments
+		if (editorPagerOpen(filename) == 0) return;
+		E.pager = 0;
+	}
+	
+	FILE *fp = fopen(filename, "r");
+	if (!fp) { // try to create if doesn't exist
+		fp = fopen(filename, "ab+");
+		fclose(fp);
+		if ((fp = fopen(filename, "r")) == NULL)
+			die("fopen");
+	}
+
+	// regular files are mapped and loaded in parallel, anything else is read line by line
+	void *data = MAP_FAILED;
+	if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if (data != MAP_FAILED) {
+		editorLoad(data, st.st_size);
+		munmap(data, st.st_size);
+	} else {
+		char *line = NULL;
+		size_t linecap = 0;
+		ssize_t linelen;
+		while((linelen = getline(&line, &linecap, fp)) != -1) {
+			ssize_t read = linelen;
+			while (linelen > 0 && (line[linelen - 1] == '\n' || 
+								   line[linelen - 1] == '\r'))
+				linelen--;
+			if (linelen < read - (line[read - 1] == '\n')) E.crlf = 1;
+			editorInsertRow(E.numrows, line, linelen);
+		}
+		free(line);
+	}
+	
+	fclose(fp);
+	
+	// rows are highlighted lazily once they are displayed
+	editorSelectSyntaxHighlight();
+	E.dirty = 0;
+	E.mod_from = INT_MAX;
+	E.mod_to = -1;
+	E.mod_rows = 0;
+	E.disk_valid = stat(filename, &E.disk_stat) == 0 && editorDiskMatches(E.disk_stat.st_size);
+	editorDiskWatch();
+	editorJournalStart();
+}
+
+// Writes the snapshot in blocks, reporting progress after each of them
+int editorSaveWrite(struct editorSave *save, int fd) {
+	size_t written = 0;
+	while (written < save->len) {
+		size_t block = save->len - written < HECTO_SAVE_BLOCK ? save->len - written : HECTO_SAVE_BLOCK;
+		ssize_t n = write(fd, save->buf + written, block);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		written += n;
+		pthread_mutex_lock(&save->lock);
+		save->written = written;
+		pthread_mutex_unlock(&save->lock);
+		if (write(save->notify[1], "", 1) == -1) {} // pipe is full, progress was reported already
+	}
+	return 0;
+}
+
+// Writes the whole file into a temporary one which then replaces it, so the file is never half-written
+int editorSaveAtomic(struct editorSave *save) {
+	size_t tlen = strlen(save->filename) + 8;
+	char *tmp = malloc(tlen);
+	snprintf(tmp, tlen, "%s.tmp~", save->filename);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		free(tmp);
+		return -1;
+	}
+	
+	struct stat st;
+	if (stat(save->filename, &st) == 0) fchmod(fd, st.st_mode & 07777);
+	int ret = editorSaveWrite(save, fd) == 0 && fsync(fd) == 0 ? 0 : -1;
+	if (close(fd) == -1) ret = -1;
+	if (ret == 0 && rename(tmp, save->filename) == 0) {
+		free(tmp);
+		return 0;
+	}
+	int err = errno;
+	unlink(tmp);
+	free(tmp);
+	errno = err;
+	return -1;
+}
+
+void *editorSaveThread(void *arg) {
+	struct editorSave *save = arg;
+	
+	// codec dying early must not kill the editor
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	
+	int ret = -1;
+	if (save->codec) {
+		ret = editorCodecSave(save);
+	} else if (save->offset == -1) {
+		ret = editorSaveAtomic(save);
+	} else {
+		// only the changed part of the file is written
+		int fd = open(save->filename, O_WRONLY | O_CLOEXEC);
+		if (fd != -1) {
+			if (lseek(fd, save->offset, SEEK_SET) != -1 && editorSaveWrite(save, fd) == 0)
+				ret = save->truncate ? ftruncate(fd, save->offset + save->len) : 0;
+			int err = errno;
+			close(fd);
+			errno = err;
+		}
+	}
+	
+	pthread_mutex_lock(&save->lock);
+	save->done = 1;
+	save->err = ret == 0 ? 0 : (errno ? errno : EIO);
+	pthread_mutex_unlock(&save->lock);
+	if (write(save->notify[1], "", 1) == -1) {} // the main loop is woken up by an earlier byte
+	return NULL;
+}
+
+// Reports progress of the save and finishes it once the thread is done
+void editorSaveNotify(int fd) {
+	char buf[256];
+	while (read(fd, buf, sizeof(buf)) > 0);
+	
+	struct editorSave *save = E.save;
+	pthread_mutex_lock(&save->lock);
+	size_t written = save->written;
+	int done = save->done;
+	pthread_mutex_unlock(&save->lock);
+	if (!done) {
+		editorSetStatusMessage("Saving %s... %d%%", save->filename, (int)(written * 100 / save->len));
+		return;
+	}
+	
+	pthread_join(save->thread, NULL);
+	editorRemoveWatch(save->notify[0]);
+	close(save->notify[0]);
+	close(save->notify[1]);
+	pthread_mutex_destroy(&save->lock);
+	E.save = NULL;
+	
+	if (save->err == 0) {
+		if (save->codec)
+			editorSetStatusMessage("%zu bytes compressed with %s and written to disk", save->len, save->codec->name);
+		else if (save->offset > 0)
+			editorSetStatusMessage("%zu bytes written to disk at offset %lld", save->len, (long long)save->offset);
+		else
+			editorSetStatusMessage("%zu bytes written to disk", save->len);
+		E.dirty -= save->dirty; // edits made during saving still have to be saved
+		if (!save->codec) E.crlf = 0; // rows are written with plain newlines
+		int stated = stat(save->filename, &E.disk_stat) == 0;
+		E.disk_valid = stated && !save->codec; // compressed files are always written whole
+		E.disk_changed = 0;
+		if (stated && E.disk_wd == -1) editorDiskWatch();
+		editorJournalReset(save->edits, save->edits_len);
+	} else {
+		E.disk_valid = 0; // nobody knows what got written, so the whole file is written next time
+		editorSetStatusMessage("Can't save! %s error: %s", save->codec ? save->codec->name : "I/O", strerror(save->err));
+	}
+	free(save->buf);
+	free(save->filename);
+	free(save->edits);
+	free(save);
+}
+
+// Blocks until the save in progress is finished, so that it isn't cut off when closing the buffer
+void editorSaveWait() {
+	while (E.save) {
+		struct pollfd fds = { E.save->notify[0], POLLIN, 0 };
+		if (poll(&fds, 1, -1) == -1 && errno != EINTR) die("poll");
+		editorSaveNotify(E.save->notify[0]);
+	}
+}
+
+// Finds out which rows have to be written when the file on disk is still as it was saved. Rows whose
+// size didn't change are patched in place, otherwise the file is rewritten from the first changed row.
+// Writing most of the file in place isn't worth the risk of leaving it half-written.
+int editorSaveIncremental(int *from, int *to, off_t *offset) {
+	struct stat st;
+	if (!E.disk_valid || stat(E.filename, &st) == -1) return 0;
+	if (st.st_ino != E.disk_stat.st_ino || st.st_size != E.disk_stat.st_size ||
+		st.st_mtim.tv_sec != E.disk_stat.st_mtim.tv_sec || st.st_mtim.tv_nsec != E.disk_stat.st_mtim.tv_nsec)
+		return 0;
+	
+	if (E.mod_from >= E.numrows && !E.mod_rows) {
+		*from = *to = E.numrows; // nothing to write
+		*offset = st.st_size;
+		return 1;
+	}
+	
+	int first = E.mod_from < E.numrows ? E.mod_from : E.numrows;
+	int last = E.numrows;
+	if (!E.mod_rows) {
+		int j;
+		for (j = first; j <= E.mod_to && E.row[j].size == E.row[j].saved_size; j++);
+		if (j > E.mod_to) last = E.mod_to + 1;
+	}
+	
+	off_t off = editorRowOffset(first);
+	off_t len = editorRowOffset(last) - off;
+	if (last == E.numrows && len > st.st_size / 2) return 0;
+	*from = first;
+	*to = last;
+	*offset = off;
+	return 1;
+}
+
+void editorSave() {
+	if (editorReadOnly()) return;
+	if (E.save) {
+		editorSetStatusMessage("File is being saved already");
+		return;
+	}
+	if (E.filename == NULL) {
+		E.filename = editorPrompt("Save as: %s", NULL);
+		if (E.filename == NULL) {
+			editorSetStatusMessage("Save aborted");
+			return;
+		}
+		editorSelectCodec();
+		editorSelectSyntaxHighlight();
+	}
+	if (E.codec_fd != -1) {
+		editorSetStatusMessage("Can't save while the file is being decompressed");
+		return;
+	}
+	if (E.disk_changed == 1) {
+		editorSetStatusMessage("WARNING! %s was changed by another program. Press Ctrl-S again to overwrite it.", E.filename);
+		E.disk_changed = 2;
+		return;
+	}
+	
+	struct editorSave *save = calloc(1, sizeof(struct editorSave));
+	int len;
+	int from = 0, to = E.numrows;
+	save->offset = -1;
+	if (!E.codec && editorSaveIncremental(&from, &to, &save->offset)) save->truncate = E.mod_rows || to == E.numrows;
+	save->buf = editorRowsToString(from, to, &len);
+	save->len = len;
+	E.mod_from = INT_MAX;
+	E.mod_to = -1;
+	E.mod_rows = 0;
+	save->filename = strdup(E.filename);
+	save->codec = E.codec;
+	save->dirty = E.dirty;
+	pthread_mutex_init(&save->lock, NULL);
+	if (pipe2(save->notify, O_NONBLOCK | O_CLOEXEC) == -1) die("pipe2");
+	if (pthread_create(&save->thread, NULL, editorSaveThread, save) != 0) die("pthread_create");
+	E.save = save;
+	editorAddWatch(save->notify[0], editorSaveNotify);
+}
+
+
+/*** journal ***/
+
+// Edits which weren't saved yet are journaled next to the file, so they can be recovered when the
+// editor doesn't get to quit (e.g. a dropped ssh session). The journal starts with the version of the
+// file it applies to and is emptied whenever the file is saved.
+
+struct editorJournalHeader {
+	char magic[8];
+	int64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t ino;
+};
+
+struct editorJournalRecord {
+	int32_t op; // 'i' for inserted character, 'n' for new line, 'd' for deleted character, 'T' for inserted
+	            // text and 'D' for deleted text
+	int32_t y, x; // cursor position before the edit
+	int32_t c; // inserted character, or length of inserted or deleted text -- inserted text follows the record
+};
+
+void editorJournalHeader(struct editorJournalHeader *h, struct stat *st) {
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, "HECTOJNL", 8);
+	h->size = st->st_size;
+	h->mtime_sec = st->st_mtim.tv_sec;
+	h->mtime_nsec = st->st_mtim.tv_nsec;
+	h->ino = st->st_ino;
+}
+
+// Journal of a file is a hidden file next to it
+char *editorJournalPath(const char *filename) {
+	const char *slash = strrchr(filename, '/');
+	int dirlen = slash ? slash - filename + 1 : 0;
+	size_t len = strlen(filename) + 18;
+	char *path = malloc(len);
+	snprintf(path, len, "%.*s.%s.hecto-journal", dirlen, filename, filename + dirlen);
+	return path;
+}
+
+void editorJournalRecord(int op, int c) {
+	editorJournalRecordAt(op, E.cy, E.cx, c);
+}
+
+// Journals an edit made at the given position instead of at the cursor
+void editorJournalRecordAt(int op, int y, int x, int c) {
+	editorClipboardEdit(y); // every edit is recorded before it's made
+	if (!E.journal) return;
+	struct editorJournalRecord r = { op, y, x, c };
+	journalAppend(E.journal, &r, sizeof(r));
+	if (E.save) {
+		E.save->edits = realloc(E.save->edits, E.save->edits_len + sizeof(r));
+		memcpy(E.save->edits + E.save->edits_len, &r, sizeof(r));
+		E.save->edits_len += sizeof(r);
+	}
+}
+
+// Journals text inserted at the given position, the text follows the record
+void editorJournalRecordText(int y, int x, const char *s, int len) {
+	editorClipboardEdit(y);
+	if (!E.journal) return;
+	struct editorJournalRecord r = { 'T', y, x, len };
+	char *data = malloc(sizeof(r) + len);
+	memcpy(data, &r, sizeof(r));
+	memcpy(data + sizeof(r), s, len);
+	journalAppend(E.journal, data, sizeof(r) + len);
+	if (E.save) {
+		E.save->edits = realloc(E.save->edits, E.save->edits_len + sizeof(r) + len);
+		memcpy(E.save->edits + E.save->edits_len, data, sizeof(r) + len);
+		E.save->edits_len += sizeof(r) + len;
+	}
+	free(data);
+}
+
+// Repeats a journaled edit, fails if it doesn't fit the rows
+int editorJournalReplay(struct editorJournalRecord *r, const char *text) {
+	if (r->y < 0 || r->y > E.numrows || r->x < 0) return -1;
+	if (r->x > (r->y < E.numrows ? E.row[r->y].size : 0)) return -1;
+	E.cy = r->y;
+	E.cx = r->x;
+	switch (r->op) {
+		case 'i':
+			editorInsertChar(r->c);
+			break;
+		case 'n':
+			editorInsertNewLine();
+			break;
+		case 'd':
+			editorDelChars();
+			break;
+		case 'T':
+			editorInsertText(r->y, r->x, text, r->c);
+			break;
+		case 'D':
+			editorDelText(r->y, r->x, r->c);
+			break;
+		default:
+			return -1;
+	}
+	return 0;
+}
+
+// Recovers edits left in the journal by a session which didn't quit, then keeps journaling new ones.
+// Edits can't be recovered before the whole file is loaded, so the buffer is read-only until then.
+void editorJournalStart() {
+	struct stat st;
+	if (E.filename == NULL || E.readonly || E.journal || stat(E.filename, &st) == -1) return;
+	
+	char *path = E.journal_path ? E.journal_path : editorJournalPath(E.filename);
+	E.journal_path = NULL;
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		free(path);
+		return;
+	}
+	// another session editing the same file owns the journal
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		editorSetStatusMessage("%s is journaled by another session, edits here won't be recoverable", E.filename);
+		close(fd);
+		free(path);
+		return;
+	}
+	
+	struct editorJournalHeader h, expect;
+	struct editorJournalRecord r;
+	editorJournalHeader(&expect, &st);
+	off_t off = 0;
+	int replayed = 0;
+	if (pread(fd, &h, sizeof(h), 0) == sizeof(h) && !memcmp(&h, &expect, sizeof(h))) {
+		off = sizeof(h);
+		if (E.codec_fd != -1 && pread(fd, &r, sizeof(r), off) == sizeof(r)) {
+			close(fd);
+			E.journal_path = path; // recovery is pending
+			return;
+		}
+		while (pread(fd, &r, sizeof(r), off) == sizeof(r)) {
+			int len = (r.op == 'T' && r.c > 0) ? r.c : 0;
+			char *text = malloc(len + 1);
+			int ok = pread(fd, text, len, off + sizeof(r)) == len && editorJournalReplay(&r, text) == 0;
+			free(text);
+			if (!ok) break;
+			off += sizeof(r) + len;
+			replayed++;
+		}
+	}
+	
+	// journal of another version of the file is of no use, and a torn last record is dropped
+	if (off == 0 && pwrite(fd, &expect, sizeof(expect), 0) == sizeof(expect)) off = sizeof(expect);
+	if (off == 0 || ftruncate(fd, off) == -1) {
+		close(fd);
+		free(path);
+		return;
+	}
+	
+	E.journal = malloc(sizeof(struct journal));
+	if (journalOpen(E.journal, fd, off) != 0) die("pthread_create");
+	E.journal_path = path;
+	if (replayed) editorSetStatusMessage("Recovered %d unsaved edits from %s", replayed, path);
+}
+
+// Starts the journal again for the file as it was just saved, keeping edits made after the save
+void editorJournalReset(const char *edits, size_t len) {
+	struct stat st;
+	if (!E.journal) {
+		if (len == 0) editorJournalStart();
+		return;
+	}
+	if (stat(E.filename, &st) == -1) return;
+	char *data = malloc(sizeof(struct editorJournalHeader) + len);
+	editorJournalHeader((struct editorJournalHeader *)data, &st);
+	if (len > 0) memcpy(data + sizeof(struct editorJournalHeader), edits, len);
+	journalReset(E.journal, data, sizeof(struct editorJournalHeader) + len);
+	free(data);
+}
+
+// Stops journaling and removes the journal, edits in it are either saved or thrown away on purpose
+void editorJournalStop() {
+	if (E.journal) {
+		journalClose(E.journal);
+		unlink(E.journal_path);
+	}
+	free(E.journal);
+	free(E.journal_path);
+	E.journal = NULL;
+	E.journal_path = NULL;
+}
+
+
+/*** pager ***/
+
+// Pager mode shows files too big to be loaded. The file is mapped and only a window of rows around
+// the screen is kept in memory, while a sparse index of line offsets is built in the background.
+
+int editorPagerWindow() {
+	return HECTO_PAGER_ROWS > 4 * E.screenrows ? HECTO_PAGER_ROWS : 4 * E.screenrows;
+}
+
+// Replaces rows with a window of them starting at the line beginning at given offset
+void editorPagerLoad(off_t start) {
+	for (int j = 0; j < E.numrows; j++) editorFreeRow(&E.row[j]);
+	E.numrows = 0;
+	E.wrap_dirty = 1;
+	E.offset_dirty = 1;
+	editorDamage(0, INT_MAX);
+	
+	int rows = editorPagerWindow();
+	E.row = realloc(E.row, sizeof(erow) * rows);
+	E.pager_offs = realloc(E.pager_offs, sizeof(off_t) * (rows + 1));
+	
+	off_t off = start;
+	while (E.numrows < rows && off < E.pager_size) {
+		const char *line = E.pager_data + off;
+		const char *nl = memchr(line, '\n', E.pager_size - off);
+		size_t linelen = (nl ? nl : E.pager_data + E.pager_size) - line;
+		
+		E.pager_offs[E.numrows] = off;
+		off += linelen + (nl ? 1 : 0);
+		while (linelen > 0 && (line[linelen - 1] == '\r')) {
+			linelen--;
+			E.crlf = 1;
+		}
+		
+		erow *row = &E.row[E.numrows];
+		editorInitRow(row, E.numrows, line, linelen);
+		editorRenderRow(row);
+		E.numrows++;
+	}
+	E.pager_offs[E.numrows] = off;
+	E.pager_comment = lineIndexCommentAt(E.pager_index, start);
+}
+
+// Row of the window starting at given offset if it's followed by enough loaded rows, -1 otherwise
+int editorPagerRowAt(off_t off, int rows) {
+	int lo = 0, hi = E.numrows;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (E.pager_offs[mid] < off) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == E.numrows || E.pager_offs[lo] != off) return -1;
+	if (lo + rows > E.numrows && E.pager_offs[E.numrows] < E.pager_size) return -1;
+	return lo;
+}
+
+// Offset of the line before the one starting at given offset
+off_t editorPagerPrevLine(off_t off) {
+	if (off <= 0) return 0;
+	const char *nl = (off > 1) ? memrchr(E.pager_data, '\n', off - 1) : NULL;
+	return nl ? nl + 1 - E.pager_data : 0;
+}
+
+// Slides the window when the screen gets close to its edge
+void editorPagerScroll() {
+	int margin = E.screenrows;
+	
+	if (E.pager_offs[E.numrows] < E.pager_size && E.cy >= E.numrows - margin) {
+		int drop = (E.cy < E.rowoff ? E.cy : E.rowoff) - margin;
+		if (drop <= 0) return;
+		editorPagerLoad(E.pager_offs[drop]);
+		E.cy -= drop;
+		E.rowoff -= drop;
+	} else if (E.pager_offs[0] > 0 && (E.cy < margin || E.rowoff < margin)) {
+		off_t off = E.pager_offs[0];
+		int back = 0;
+		while (back < editorPagerWindow() / 2 && off > 0) {
+			off = editorPagerPrevLine(off);
+			back++;
+		}
+		editorPagerLoad(off);
+		E.cy += back;
+		E.rowoff += back;
+	}
+}
+
+// Loads window at the line containing given offset and puts cursor on it
+void editorPagerGotoOffset(off_t offset) {
+	if (offset > E.pager_size) offset = E.pager_size;
+	if (offset < 0) offset = 0;
+	off_t start = offset;
+	if (start > 0 && E.pager_data[start - 1] != '\n') start = editorPagerPrevLine(start);
+	
+	editorPagerLoad(start);
+	E.cy = 0;
+	E.cx = offset - start;
+	if (E.numrows > 0 && E.cx > E.row[0].size) E.cx = E.row[0].size;
+	E.rowoff = 0;
+	E.wrapoff = 0;
+}
+
+void editorPagerGotoLine(long long line) {
+	off_t offset;
+	if (line < 0) line = 0;
+	if (lineIndexFind(E.pager_index, line, &offset) == -1) {
+		editorSetStatusMessage("Line %lld wasn't indexed yet", line + 1);
+		return;
+	}
+	editorPagerGotoOffset(offset);
+}
+
+// Number of the line shown in window row at, -1 if it's not known yet
+long long editorPagerLine(int at) {
+	return lineIndexLineOf(E.pager_index, E.pager_offs[at]);
+}
+
+// Searches the mapped file for the next match in given direction (0 includes the cursor position),
+// loads window around it and returns its row, or -1 if there's no match
+int editorPagerFind(char *query, int direction, int *cx) {
+	size_t qlen = strlen(query);
+	off_t cursor = (E.cy < E.numrows) ? E.pager_offs[E.cy] + E.cx : E.pager_offs[E.numrows];
+	const char *data = E.pager_data;
+	const char *match = NULL;
+	
+	if (direction >= 0) {
+		off_t from = cursor + (direction > 0);
+		if (from < E.pager_size) match = memmem(data + from, E.pager_size - from, query, qlen);
+		if (!match) match = memmem(data, E.pager_size, query, qlen);
+	} else {
+		// backwards: last match starting before the cursor, wrapping around to the end of file
+		for (int pass = 0; pass < 2 && !match; pass++) {
+			off_t end = pass ? E.pager_size : cursor;
+			const char *p = data + end;
+			while (p > data && (p = memrchr(data, query[0], p - data)) != NULL) {
+				if (p + qlen <= data + E.pager_size && !memcmp(p, query, qlen)) {
+					match = p;
+					break;
+				}
+			}
+		}
+	}
+	if (!match) return -1;
+	
+	off_t offset = match - data;
+	if (offset < E.pager_offs[0] || offset >= E.pager_offs[E.numrows]) editorPagerGotoOffset(offset);
+	
+	int lo = 0, hi = E.numrows - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (E.pager_offs[mid] <= offset) lo = mid;
+		else hi = mid - 1;
+	}
+	*cx = offset - E.pager_offs[lo];
+	return lo;
+}
+
+// Jumps to the line that was asked for before it got indexed
+void editorPagerGotoPending() {
+	if (E.pager_goto == -1) return;
+	long long lines;
+	int done;
+	lineIndexProgress(E.pager_index, &lines, NULL, &done);
+	if (E.pager_goto >= lines && !done) return;
+	if (E.pager_goto >= lines) E.pager_goto = lines > 0 ? lines - 1 : 0;
+	editorPagerGotoLine(E.pager_goto);
+	E.pager_goto = -1;
+}
+
+void editorPagerNotify(int fd) {
+	char buf[256];
+	while (read(fd, buf, sizeof(buf)) > 0); // status bar shows the progress
+	
+	// highlight of the window is redone once it's known to start inside of a comment
+	if (E.pager_comment == -1 && E.numrows > 0) {
+		E.pager_comment = lineIndexCommentAt(E.pager_index, E.pager_offs[0]);
+		for (int j = 0; E.pager_comment == 1 && j < E.numrows; j++) {
+			E.row[j].hl_valid = 0;
+			if (E.row[j].ckpt) E.row[j].ckpt_dirty = 1;
+		}
+	}
+	editorPagerGotoPending();
+	
+	if (E.pager_cache && !E.pager_cached && lineIndexComplete(E.pager_index)) {
+		lineIndexSave(E.pager_index, E.pager_cache, E.pager_path, &E.pager_stat,
+			E.syntax ? E.syntax->filetype : NULL);
+		E.pager_cached = 1;
+	}
+}
+
+// Maps the file and starts indexing it, returns -1 if the file can't be opened
+int editorPagerOpen(char *filename) {
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return -1;
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	
+	E.pager_size = st.st_size;
+	E.pager_data = NULL;
+	if (E.pager_size > 0) {
+		E.pager_data = mmap(NULL, E.pager_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (E.pager_data == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		madvise((void *)E.pager_data, E.pager_size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	
+	if (pipe2(E.pager_notify, O_NONBLOCK | O_CLOEXEC) == -1) die("pipe2");
+	editorAddWatch(E.pager_notify[0], editorPagerNotify);
+	E.pager_index = malloc(sizeof(struct lineIndex)); // the index thread keeps pointing at it
+	lineIndexInit(E.pager_index, E.pager_data, E.pager_size, E.pager_notify[1]);
+	
+	// index is cached for as long as the file doesn't change, comments for as long as its syntax doesn't
+	E.pager_stat = st;
+	E.pager_cached = 0;
+	if (E.cache && (E.pager_path = realpath(filename, NULL)) != NULL)
+		E.pager_cache = lineIndexCachePath(E.pager_path);
+	if (E.pager_cache && lineIndexLoad(E.pager_index, E.pager_cache, E.pager_path, &st,
+		E.syntax ? E.syntax->filetype : NULL) == 0)
+		E.pager_cached = 1;
+	
+	int comments = E.syntax && E.syntax->multiline_comment_start;
+	if (lineIndexStart(E.pager_index, comments ? editorLexComment : NULL, E.syntax) != 0)
+		die("pthread_create");
+	if (E.pager_cached) E.pager_cached = lineIndexComplete(E.pager_index);
+	
+	E.pager = 1;
+	E.readonly = 1;
+	editorPagerLoad(0);
+	return 0;
+}
+
+
+/*** find ***/
+
+char *find_query = NULL; // text of the last search
+
+void editorFindCallback(char *query, int key) {
+	static int last_match = -1;
+	static int direction = 1;
+	
+	static int saved_hl_line;
+	static int saved_hl_off;
+	static int saved_hl_len;
+	static char *saved_hl = NULL;
+	
+	if (saved_hl) {
+		erow *row = &E.row[saved_hl_line];
+		if (saved_hl_line < E.numrows && row->hl_valid) {
+			editorDamage(saved_hl_line, saved_hl_line);
+			if (row->roff == saved_hl_off && row->rsize == saved_hl_len)
+				memcpy(row->hl, saved_hl, row->rsize);
+			else
+				editorRowRenderWindow(row, row->roff);
+		}
+		free(saved_hl);
+		saved_hl = NULL;
+	}
+	
+	if (key == '\r' || key == '\x1b') {
+		last_match = -1;
+		direction = 1;
+		if (key == '\x1b') editorSetStatusMessage("Search Cancelled");
+		return;
+	} else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+		direction = 1;
+	} else if (key == ARROW_LEFT || key == ARROW_UP) {
+		direction = -1;
+	} else {
+		last_match = -1;
+		direction = 1;
+	}
+	
+	if (last_match == -1) direction = 1;
+	int current = -1;
+	int cx = 0;
+	if (E.pager) {
+		current = editorPagerFind(query, last_match == -1 ? 0 : direction, &cx);
+	} else {
+		current = last_match;
+		int i;
+		for (i = 0; i < E.numrows; i++) {
+			current += direction;
+			if (current == -1) current = E.numrows - 1;
+			else if (current == E.numrows) current = 0;
+			
+			/* TO DO */
+			/* Right now search only finds first occurence on each line, that means it can't locate two substring on signle line */
+			
+			char *match = strstr(E.row[current].chars, query);
+			if (match) {
+				cx = match - E.row[current].chars;
+				break;
+			}
+		}
+		if (i == E.numrows) current = -1;
+	}
+	
+	if (current != -1) {
+		erow *row = &E.row[current];
+		editorSyntaxEnsure(current);
+		last_match = current;
+		E.cy = current;
+		E.cx = cx;
+		E.rowoff = E.numrows;
+		
+		// long rows have to be rendered around the match so it can be highlighted
+		int rx = editorRowCxToRx(row, E.cx);
+		editorRowPrepareWindow(row, rx - E.screencols, 2 * E.screencols);
+		
+		saved_hl_line = current;
+		saved_hl_off = row->roff;
+		saved_hl_len = row->rsize;
+		saved_hl = malloc(row->rsize);
+		memcpy(saved_hl, row->hl, row->rsize);
+		int len = strlen(query);
+		int at = editorRenderOffset(row, rx);
+		if (at + len > row->rsize) len = row->rsize - at;
+		if (len > 0) memset(&row->hl[at], HL_MATCH, len);
+		editorDamage(current, current);
+	}
+}
+
+void editorFind() {
+	int saved_cx = E.cx;
+	int saved_cy = E.cy;
+	int saved_coloff = E.coloff;
+	int saved_rowoff = E.rowoff;
+	
+	char *query = editorPrompt("Search: %s (Use ECS/Enter/Arrows)", 
+								editorFindCallback);
+	
+	if (query) {
+		free(find_query);
+		find_query = query;
+	} else {
+		E.cx = saved_cx;
+		E.cy = saved_cy;
+		E.coloff = saved_coloff;
+		E.rowoff = saved_rowoff;
+	}
+}
+
+// Puts a cursor behind every match of the last search, the first one from the cursor on becomes the cursor
+void editorFindCursors() {
+	if (E.pager) {
+		editorSetStatusMessage("Cursors aren't available in pager mode");
+		return;
+	}
+	if (!find_query || !*find_query) {
+		editorSetStatusMessage("Search for the text first (Ctrl-F)");
+		return;
+	}
+	
+	int len = strlen(find_query);
+	struct editorCursor *cur = NULL;
+	int n = 0, cap = 0, primary = -1;
+	for (int y = 0; y < E.numrows; y++) {
+		char *p = E.row[y].chars;
+		char *match;
+		while ((match = strstr(p, find_query)) != NULL) {
+			if (n == cap) {
+				cap = cap ? cap * 2 : 64;
+				cur = realloc(cur, sizeof(struct editorCursor) * cap);
+			}
+			cur[n] = (struct editorCursor){ match - E.row[y].chars + len, y, 0 };
+			if (primary == -1 && (y > E.cy || (y == E.cy && cur[n].cx >= E.cx))) primary = n;
+			n++;
+			p = match + len;
+		}
+	}
+	if (n == 0) {
+		editorSetStatusMessage("No matches of \"%s\"", find_query);
+		return;
+	}
+	cur[primary == -1 ? 0 : primary].primary = 1;
+	editorCursorsScatter(cur, n);
+	editorSetStatusMessage("%d cursors", n);
+}
+
+
+/*** soft wrap ***/
+
+// With soft wrap on, rows are split into screen-wide lines. Number of lines every row takes is kept
+// in a Fenwick tree, so mapping between screen lines and rows is O(log n) anywhere in the file.
+
+// Columns rows are drawn in, line numbers take the rest of the screen width
+int editorTextCols() {
+	return (E.show_numline && E.screencols > HECTO_NUMLINE) ? E.screencols - HECTO_NUMLINE : E.screencols;
+}
+
+int editorWrapHeight(erow *row) {
+	return row->rwidth / editorTextCols() + 1;
+}
+
+long long editorWrapValue(int i) {
+	E.row[i].wrap_h = editorWrapHeight(&E.row[i]);
+	return E.row[i].wrap_h;
+}
+
+// Rebuilds wrap index after rows were added or removed
+void editorWrapIndex() {
+	if (E.wrap_dirty || E.wrap.n != E.numrows) {
+		fenwickBuild(&E.wrap, E.numrows, editorWrapValue);
+		E.wrap_dirty = 0;
+	}
+}
+
+// Updates wrap index after the row was edited
+void editorWrapUpdateRow(erow *row) {
+	if (!E.softwrap || E.wrap_dirty || row->idx >= E.wrap.n) return;
+	int h = editorWrapHeight(row);
+	if (h != row->wrap_h) {
+		fenwickAdd(&E.wrap, row->idx, h - row->wrap_h);
+		row->wrap_h = h;
+	}
+}
+
+// Screen line at which row at starts
+long long editorWrapLine(int at) {
+	return fenwickSum(&E.wrap, at);
+}
+
+// Finds row and its wrapped line shown at the given screen line
+void editorWrapLocate(long long line, int *at, int *sub) {
+	if (line < 0) line = 0;
+	*at = fenwickSearch(&E.wrap, line);
+	*sub = line - editorWrapLine(*at);
+}
+
+// Moves cursor one screen line up or down
+void editorWrapMoveCursor(int key) {
+	erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+	int rx = row ? editorRowCxToRx(row, E.cx) : 0;
+	int cols = editorTextCols();
+	int x = rx % cols;
+	
+	if (key == ARROW_DOWN) {
+		if (row && rx / cols < editorWrapHeight(row) - 1) {
+			E.cx = editorRowRxToCx(row, rx + cols);
+		} else if (E.cy < E.numrows) {
+			E.cy++;
+			E.cx = (E.cy < E.numrows) ? editorRowRxToCx(&E.row[E.cy], x) : 0;
+		}
+	} else {
+		if (row && rx >= cols) {
+			E.cx = editorRowRxToCx(row, rx - cols);
+		} else if (E.cy > 0) {
+			E.cy--;
+			row = &E.row[E.cy];
+			E.cx = editorRowRxToCx(row, (editorWrapHeight(row) - 1) * cols + x);
+		}
+	}
+}
+
+// Scrolls by a whole screen and puts cursor on the first line of it
+void editorWrapPage(int dir) {
+	editorWrapIndex();
+	long long top = editorWrapLine(E.rowoff) + E.wrapoff + dir * E.screenrows;
+	long long total = editorWrapLine(E.numrows);
+	if (top > total) top = total;
+	
+	editorWrapLocate(top, &E.rowoff, &E.wrapoff);
+	E.cy = E.rowoff;
+	E.cx = (E.cy < E.numrows) ? editorRowRxToCx(&E.row[E.cy], E.wrapoff * editorTextCols()) : 0;
+}
+
+
+/*** offsets ***/
+
+// Size of every row including its newline is kept in a Fenwick tree as well, so byte offsets in the file
+// and positions in rows map to each other in O(log n). It's rebuilt only after rows were added or removed.
+
+long long editorOffsetValue(int i) {
+	return E.row[i].size + 1;
+}
+
+// Rebuilds offset index after rows were added or removed
+void editorOffsetIndex() {
+	if (E.offset_dirty || E.offsets.n != E.numrows) {
+		fenwickBuild(&E.offsets, E.numrows, editorOffsetValue);
+		E.offset_dirty = 0;
+	}
+}
+
+// Updates offset index after the row was edited
+void editorOffsetUpdateRow(erow *row) {
+	if (E.offset_dirty || row->idx >= E.offsets.n) return;
+	long long delta = row->size + 1 - fenwickGet(&E.offsets, row->idx);
+	if (delta) fenwickAdd(&E.offsets, row->idx, delta);
+}
+
+// Byte offset at which row at starts
+long long editorRowOffset(int at) {
+	editorOffsetIndex();
+	return fenwickSum(&E.offsets, at);
+}
+
+// Finds row and position in it of given byte of the file, past the end of file it's the row after the last one
+void editorOffsetLocate(long long offset, int *at, int *cx) {
+	if (offset < 0) offset = 0;
+	editorOffsetIndex();
+	*at = fenwickSearch(&E.offsets, offset);
+	*cx = 0;
+	if (*at < E.numrows) {
+		long long pos = offset - fenwickSum(&E.offsets, *at);
+		*cx = pos > E.row[*at].size ? E.row[*at].size : pos;
+	}
+}
+
+
+/*** navigation ***/
+
+// Puts cursor at the beginning of the row and scrolls it to the top of the screen
+void editorGotoRow(int at) {
+	if (at > E.numrows) at = E.numrows;
+	if (at < 0) at = 0;
+	E.cy = at;
+	E.cx = 0;
+	E.rowoff = at;
+	E.wrapoff = 0;
+}
+
+// Moves cursor to the row containing given byte of the file
+void editorGotoOffset(long long offset) {
+	int at, cx;
+	editorOffsetLocate(offset, &at, &cx);
+	editorGotoRow(at);
+	E.cx = cx;
+}
+
+void editorGotoPercent(int percent) {
+	if (percent < 0) percent = 0;
+	if (percent > 100) percent = 100;
+	editorGotoRow((long long)E.numrows * percent / 100);
+}
+
+// Scrolls by a whole screen
+void editorPageMove(int dir) {
+	if (E.softwrap) {
+		editorWrapPage(dir);
+		return;
+	}
+	
+	if (dir < 0) {
+		E.cy = E.rowoff - E.screenrows;
+		if (E.cy < 0) E.cy = 0;
+	} else {
+		E.cy = E.rowoff + 2 * E.screenrows - 1;
+		if (E.cy > E.numrows) E.cy = E.numrows;
+	}
+	
+	int rowlen = (E.cy < E.numrows) ? E.row[E.cy].size : 0;
+	if (E.cx > rowlen) E.cx = rowlen;
+}
+
+// Asks where to go -- a line number, a percentage of the file ('50%') or a byte offset ('@1024')
+void editorGoto() {
+	char *query = editorPrompt("Go to: %s (line, N% or @offset)", NULL);
+	if (query == NULL) return;
+	
+	char *end;
+	int valid;
+	if (query[0] == '@') {
+		long long offset = strtoll(&query[1], &end, 10);
+		valid = end != &query[1] && *end == '\0' && offset >= 0;
+		if (valid && E.pager) editorPagerGotoOffset(offset);
+		else if (valid) editorGotoOffset(offset);
+	} else {
+		long long line = strtoll(query, &end, 10);
+		valid = end != query && (*end == '\0' || (end[0] == '%' && end[1] == '\0'));
+		if (valid && *end == '%') {
+			if (line < 0) line = 0;
+			if (line > 100) line = 100;
+			if (E.pager) editorPagerGotoOffset(E.pager_size / 100 * line + E.pager_size % 100 * line / 100);
+			else editorGotoPercent(line);
+		} else if (valid) {
+			// lines past the end go to the last one, numbers too big for a row can't wrap around
+			long long last = E.numrows > 0 ? E.numrows : 1;
+			if (E.pager) {
+				off_t scanned;
+				int done;
+				lineIndexProgress(E.pager_index, &last, &scanned, &done);
+				if (!done || last < 1) last = LLONG_MAX;
+			}
+			if (line < 1) line = 1;
+			if (line > last) line = last;
+			if (E.pager) editorPagerGotoLine(line - 1);
+			else editorGotoRow(line - 1);
+		}
+	}
+	if (!valid) editorSetStatusMessage("Invalid position: %s", query);
+	free(query);
+}
+
+
+/*** buffers ***/
+
+// Every open file has its own buffer. The active one lives in E, the others are kept in a list and
+// swapped with E when switching, so the rest of the editor only ever works with E.
+
+struct editorConfig *buffers; // E is stored at index curbuf whenever another buffer is active
+int nbuffers = 0;
+int curbuf = 0;
+int nextid = 0;
+unsigned long bufclock = 0; // ticks whenever a buffer gets activated, to find least recently used ones
+
+// Resets E into an empty buffer, settings of the whole editor are left alone
+void editorBufferInit() {
+	E.id = nextid++;
+	E.used = ++bufclock;
+	E.cx = 0;
+	E.cy = 0;
+	E.rx = 0;
+	E.cursors = NULL;
+	E.ncursors = 0;
+	E.sel_mode = 0;
+	E.rowoff = 0;
+	E.coloff = 0;
+	E.numrows = 0;
+	E.row = NULL;
+	E.dirty = 0;
+	E.filename = NULL;
+	E.syntax = NULL;
+	E.softwrap = 0;
+	E.wrapoff = 0;
+	E.wrap = (struct fenwick) FENWICK_INIT;
+	E.wrap_dirty = 1;
+	E.offsets = (struct fenwick) FENWICK_INIT;
+	E.offset_dirty = 1;
+	E.follow = 0;
+	E.readonly = 0;
+	E.pager = 0;
+	E.pager_index = NULL;
+	E.pager_offs = NULL;
+	E.pager_comment = -1;
+	E.pager_goto = -1;
+	E.pager_cache = NULL;
+	E.pager_path = NULL;
+	E.codec = NULL;
+	E.codec_fd = -1;
+	E.filter_pid = 0;
+	E.filter_in = -1;
+	E.filter_out = -1;
+	E.window = -1;
+	E.journal = NULL;
+	E.journal_path = NULL;
+	E.save = NULL;
+	E.mod_from = INT_MAX;
+	E.mod_to = -1;
+	E.mod_rows = 0;
+	E.disk_valid = 0;
+	E.disk_wd = -1;
+	E.disk_changed = 0;
+	E.damage_from = 0;
+	E.damage_to = INT_MAX;
+}
+
+// Makes buffer at index j active without saving the active one, settings of the editor carry over
+void editorBufferLoad(int j) {
+	struct editorConfig next = buffers[j];
+	next.screenrows = E.screenrows;
+	next.screencols = E.screencols;
+	next.show_numline = E.show_numline;
+	memcpy(next.statusmsg, E.statusmsg, sizeof(E.statusmsg));
+	next.statusmsg_time = E.statusmsg_time;
+	next.cache = E.cache;
+	E = next;
+	curbuf = j;
+}
+
+void editorBufferActivate(int j) {
+	if (j == curbuf) return;
+	buffers[curbuf] = E;
+	editorBufferLoad(j);
+}
+
+int editorBufferFind(int id) {
+	for (int j = 0; j < nbuffers; j++)
+		if ((j == curbuf ? E.id : buffers[j].id) == id) return j;
+	return -1;
+}
+
+// Copies the text the clipboard refers to, rows of an inactive buffer are copied with it made active
+// for the time being
+char *editorClipboardCopy() {
+	size_t len;
+	int j = editorBufferFind(clipboard.buffer);
+	if (j == curbuf) return editorClipboardCopyRows(&len);
+	struct editorConfig active = E;
+	E = buffers[j];
+	char *text = editorClipboardCopyRows(&len);
+	buffers[j] = E;
+	E = active;
+	return text;
+}
+
+// Drops rendered text and highlight of the row, they are made again once the row is displayed
+void editorRowEvict(erow *row) {
+	free(row->render);
+	free(row->hl);
+	row->render = NULL;
+	row->hl = NULL;
+	row->rsize = 0;
+	row->rcols = 0;
+	row->hl_valid = 0;
+}
+
+// Memory taken by text of the buffer's rows and by caches made from it
+void editorBufferMemory(struct editorConfig *b, size_t *text, size_t *cache) {
+	*text = sizeof(erow) * b->numrows;
+	*cache = 0;
+	for (int j = 0; j < b->numrows; j++) {
+		erow *row = &b->row[j];
+		*text += row->size + 1;
+		if (row->render) *cache += row->rsize + 1;
+		if (row->hl) *cache += row->rsize;
+	}
+}
+
+// Keeps memory of all buffers within budget, dropping caches of inactive buffers least recently
+// used first -- the active buffer is never touched
+void editorBufferEvict() {
+	buffers[curbuf] = E;
+	size_t total = 0;
+	size_t *caches = malloc(sizeof(size_t) * nbuffers);
+	for (int j = 0; j < nbuffers; j++) {
+		size_t text;
+		editorBufferMemory(&buffers[j], &text, &caches[j]);
+		total += text + caches[j];
+	}
+	
+	while (total > HECTO_MEM_BUDGET) {
+		int lru = -1;
+		for (int j = 0; j < nbuffers; j++)
+			if (j != curbuf && caches[j] > 0 && (lru == -1 || buffers[j].used < buffers[lru].used)) lru = j;
+		if (lru == -1) break;
+		
+		for (int k = 0; k < buffers[lru].numrows; k++) editorRowEvict(&buffers[lru].row[k]);
+		total -= caches[lru];
+		caches[lru] = 0;
+	}
+	free(caches);
+}
+
+// Switches to the buffer at index j
+void editorBufferSwitch(int j) {
+	editorBufferActivate(j);
+	E.used = ++bufclock;
+	editorBufferEvict();
+	editorSetStatusMessage("Buffer %d/%d: %s", curbuf + 1, nbuffers, E.filename ? E.filename : "[No Name]");
+}
+
+// Adds an empty buffer and makes it active
+void editorBufferNew() {
+	buffers[curbuf] = E;
+	buffers = realloc(buffers, sizeof(struct editorConfig) * (nbuffers + 1));
+	curbuf = nbuffers++;
+	editorBufferInit();
+}
+
+// Releases everything held by the active buffer
+void editorBufferFree() {
+	editorClipboardRelease();
+	editorSaveWait();
+	editorJournalStop();
+	editorDiskForget();
+	if (E.follow) editorToggleFollow();
+	if (E.codec_fd != -1) {
+		editorRemoveWatch(E.codec_fd);
+		close(E.codec_fd);
+		kill(E.codec_pid, SIGTERM);
+		waitpid(E.codec_pid, NULL, 0);
+	}
+	if (E.filter_pid) editorFilterStop(1);
+	if (E.pager) {
+		lineIndexStop(E.pager_index);
+		free(E.pager_index);
+		editorRemoveWatch(E.pager_notify[0]);
+		close(E.pager_notify[0]);
+		close(E.pager_notify[1]);
+		if (E.pager_data) munmap((void *)E.pager_data, E.pager_size);
+		free(E.pager_offs);
+		free(E.pager_cache);
+		free(E.pager_path);
+	}
+	for (int j = 0; j < E.numrows; j++) editorFreeRow(&E.row[j]);
+	free(E.row);
+	free(E.filename);
+	free(E.cursors);
+	fenwickFree(&E.wrap);
+	fenwickFree(&E.offsets);
+}
+
+// Closes the active buffer and switches to the next one, there's always at least one buffer left
+void editorBufferClose() {
+	if (nbuffers == 1) return;
+	int id = E.id;
+	editorBufferFree();
+	memmove(&buffers[curbuf], &buffers[curbuf + 1], sizeof(struct editorConfig) * (nbuffers - curbuf - 1));
+	nbuffers--;
+	editorBufferLoad(curbuf < nbuffers ? curbuf : nbuffers - 1);
+	E.used = ++bufclock;
+	editorWindowForget(id);
+	editorSetStatusMessage("Buffer %d/%d: %s", curbuf + 1, nbuffers, E.filename ? E.filename : "[No Name]");
+}
+
+// Asks for a file and opens it in a new buffer, or switches to the buffer it is already open in
+void editorBufferOpen() {
+	char *filename = editorPrompt("Open: %s", NULL);
+	if (filename == NULL) return;
+	
+	for (int j = 0; j < nbuffers; j++) {
+		char *name = (j == curbuf) ? E.filename : buffers[j].filename;
+		if (name && !strcmp(name, filename)) {
+			free(filename);
+			editorBufferSwitch(j);
+			return;
+		}
+	}
+	
+	editorBufferNew();
+	editorOpen(filename);
+	free(filename);
+	editorBufferEvict();
+	editorSetStatusMessage("Buffer %d/%d: %s", curbuf + 1, nbuffers, E.filename);
+}
+
+
+/*** windows ***/
+
+// Screen is split into windows, each showing a buffer through its own viewport. Windows form a tree
+// whose inner nodes are split either horizontally (one above the other) or vertically (side by side).
+// E always holds the buffer of the active window, with the viewport and size of that window.
+
+struct editorWindow {
+	int id;
+	int buffer; // id of the shown buffer
+	int cx, cy, rx, rowoff, coloff, wrapoff; // viewport, kept while another window is active
+	off_t pager_base; // offset where rows of a paged buffer started when the window was last left
+	int top, left, rows, cols; // area on screen including the status bar at its bottom
+	char split; // 0 for windows showing a buffer, 'h' or 'v' for windows split into first and second
+	struct editorWindow *parent, *first, *second;
+	int drawn; // whether the window was drawn in its current area
+	int last_buffer, last_rowoff, last_coloff, last_wrapoff, last_numline, last_softwrap; // viewport last drawn
+};
+
+struct editorWindow *root; // window taking up the whole screen
+struct editorWindow *win; // active window
+int termrows, termcols; // size of the terminal
+int nextwin = 0;
+
+struct editorWindow *editorWindowNew(struct editorWindow *parent) {
+	struct editorWindow *w = calloc(1, sizeof(struct editorWindow));
+	w->id = nextwin++;
+	w->buffer = E.id;
+	w->parent = parent;
+	return w;
+}
+
+// Marks rows of the active buffer as changed, so windows showing them get redrawn
+void editorDamage(int from, int to) {
+	if (from < E.damage_from) E.damage_from = from;
+	if (to > E.damage_to) E.damage_to = to;
+}
+
+// Places the window and its children in given area
+void editorWindowLayout(struct editorWindow *w, int top, int left, int rows, int cols) {
+	if (w->top != top || w->left != left || w->rows != rows || w->cols != cols) w->drawn = 0;
+	w->top = top;
+	w->left = left;
+	w->rows = rows;
+	w->cols = cols;
+	if (w->split == 'h') {
+		editorWindowLayout(w->first, top, left, rows / 2, cols);
+		editorWindowLayout(w->second, top + rows / 2, left, rows - rows / 2, cols);
+	} else if (w->split == 'v') {
+		int first = (cols - 1) / 2; // one column is taken by the separator
+		editorWindowLayout(w->first, top, left, rows, first);
+		editorWindowLayout(w->second, top, left + first + 1, rows, cols - first - 1);
+	}
+}
+
+// Window following given one on screen, wrapping around to the first one
+struct editorWindow *editorWindowNext(struct editorWindow *w) {
+	while (w->parent && w->parent->second == w) w = w->parent;
+	w = w->parent ? w->parent->second : root;
+	while (w->split) w = w->first;
+	return w;
+}
+
+// Stores the viewport of the active window, its buffer stays in E
+void editorWindowLeave() {
+	win->buffer = E.id;
+	win->cx = E.cx;
+	win->cy = E.cy;
+	win->rx = E.rx;
+	win->rowoff = E.rowoff;
+	win->coloff = E.coloff;
+	win->wrapoff = E.wrapoff;
+	if (E.pager) win->pager_base = E.pager_offs[0];
+	E.window = win->id;
+}
+
+// Makes the window active loading its buffer and viewport into E. The viewport is only loaded if
+// another window used the buffer since, otherwise the buffer has the newest one (e.g. from follow mode).
+void editorWindowEnter(struct editorWindow *w) {
+	win = w;
+	int j = editorBufferFind(w->buffer);
+	if (j == -1) w->buffer = E.id; // its buffer got closed
+	else editorBufferActivate(j);
+	E.screenrows = w->rows - 1;
+	E.screencols = w->cols;
+	if (E.window == w->id) return;
+	
+	// windows showing nearby parts of a paged file share its loaded rows instead of reloading them
+	int shift = 0;
+	if (E.pager && E.pager_offs[0] != w->pager_base) {
+		int need = (w->cy > w->rowoff + E.screenrows ? w->cy : w->rowoff + E.screenrows) + 1;
+		shift = editorPagerRowAt(w->pager_base, need);
+		if (shift == -1) {
+			editorPagerLoad(w->pager_base);
+			shift = 0;
+		}
+	}
+	E.cx = w->cx;
+	E.cy = w->cy + shift;
+	E.rx = w->rx;
+	E.rowoff = w->rowoff + shift;
+	E.coloff = w->coloff;
+	E.wrapoff = w->wrapoff;
+	E.window = w->id;
+	
+	// the buffer may have been edited in another window
+	if (E.cy > E.numrows) E.cy = E.numrows;
+	if (E.cy < E.numrows && E.cx > E.row[E.cy].size) E.cx = E.row[E.cy].size;
+	if (E.cy == E.numrows) E.cx = 0;
+	if (E.rowoff > E.cy) E.rowoff = E.cy;
+}
+
+void editorWindowSplit(char split) {
+	if ((split == 'h' && win->rows < 6) || (split == 'v' && win->cols < 21)) {
+		editorSetStatusMessage("Window is too small to split");
+		return;
+	}
+	editorWindowLeave();
+	
+	struct editorWindow *node = editorWindowNew(win->parent);
+	struct editorWindow *twin = editorWindowNew(node);
+	*twin = *win;
+	twin->id = nextwin++;
+	twin->parent = node;
+	twin->drawn = 0;
+	node->split = split;
+	node->first = win;
+	node->second = twin;
+	
+	if (!win->parent) root = node;
+	else if (win->parent->first == win) win->parent->first = node;
+	else win->parent->second = node;
+	win->parent = node;
+	
+	editorWindowLayout(root, 0, 0, termrows - 1, termcols);
+	editorWindowEnter(win);
+}
+
+void editorWindowClose() {
+	if (!win->parent) {
+		editorSetStatusMessage("Can't close the only window");
+		return;
+	}
+	editorWindowLeave();
+	
+	struct editorWindow *node = win->parent;
+	struct editorWindow *sibling = (node->first == win) ? node->second : node->first;
+	sibling->parent = node->parent;
+	if (!node->parent) root = sibling;
+	else if (node->parent->first == node) node->parent->first = sibling;
+	else node->parent->second = sibling;
+	free(win);
+	free(node);
+	
+	struct editorWindow *w = sibling;
+	while (w->split) w = w->first;
+	editorWindowLayout(root, 0, 0, termrows - 1, termcols);
+	editorWindowEnter(w);
+}
+
+void editorWindowSwitch() {
+	editorWindowLeave();
+	editorWindowEnter(editorWindowNext(win));
+}
+
+// Windows showing a closed buffer show the active one instead
+void editorWindowForget(int id) {
+	struct editorWindow *w = win;
+	do {
+		if (w->buffer == id) w->buffer = E.id;
+		w = editorWindowNext(w);
+	} while (w != win);
+}
+
+
+/*** event loop ***/
+
+// Besides keyboard input the editor waits for events of background work (like following a file).
+// Every watched descriptor has a handler which is run when the descriptor becomes readable, or
+// writable for pipes the editor writes to.
+struct editorWatch {
+	int fd;
+	short events; // POLLIN or POLLOUT
+	void (*handler)(int fd);
+	int buffer; // id of the buffer the handler works with
+};
+
+struct editorWatch watches[HECTO_MAX_WATCHES];
+int nwatches = 0;
+
+void editorAddWatch(int fd, void (*handler)(int fd)) {
+	if (nwatches == HECTO_MAX_WATCHES) die("editorAddWatch");
+	watches[nwatches].fd = fd;
+	watches[nwatches].events = POLLIN;
+	watches[nwatches].handler = handler;
+	watches[nwatches].buffer = E.id;
+	nwatches++;
+}
+
+void editorAddWriteWatch(int fd, void (*handler)(int fd)) {
+	editorAddWatch(fd, handler);
+	watches[nwatches - 1].events = POLLOUT;
+}
+
+void editorRemoveWatch(int fd) {
+	for (int j = 0; j < nwatches; j++) {
+		if (watches[j].fd == fd) {
+			watches[j] = watches[--nwatches];
+			return;
+		}
+	}
+}
+
+// Waits until a key is pressed, handling other events in the meantime and redrawing screen after them
+void editorWaitInput() {
+	while (1) {
+		struct pollfd fds[HECTO_MAX_WATCHES + 1];
+		fds[0].fd = STDIN_FILENO;
+		fds[0].events = POLLIN;
+		int n = nwatches;
+		for (int j = 0; j < n; j++) {
+			fds[j + 1].fd = watches[j].fd;
+			fds[j + 1].events = watches[j].events;
+		}
+		
+		if (poll(fds, n + 1, -1) == -1) {
+			if (errno == EINTR) continue;
+			die("poll");
+		}
+		
+		int handled = 0;
+		for (int j = 0; j < n; j++) {
+			if (fds[j + 1].revents) {
+				// handler may remove watches, so look it up again by its descriptor
+				for (int k = 0; k < nwatches; k++) {
+					if (watches[k].fd == fds[j + 1].fd) {
+						// handlers of inactive buffers run with their buffer made active for a while
+						int active = curbuf;
+						int owner = editorBufferFind(watches[k].buffer);
+						if (owner != -1) editorBufferActivate(owner);
+						watches[k].handler(watches[k].fd);
+						editorBufferActivate(active);
+						handled = 1;
+						break;
+					}
+				}
+			}
+		}
+		if (handled) editorRefreshScreen();
+		if (fds[0].revents) return;
+	}
+}
+
+
+/*** follow mode ***/
+
+// Follow mode keeps appending whatever gets written to the opened file (like 'tail -f'). Only new
+// bytes are read, truncated files are read again from the start and rotated ones are followed
+// under their name.
+
+void editorFollowRead() {
+	int at_end = (E.cy >= E.numrows - 1);
+	int dirty = E.dirty;
+	
+	char buf[65536];
+	ssize_t nread;
+	while ((nread = pread(E.follow_fd, buf, sizeof(buf), E.follow_off)) > 0) {
+		editorAppendText(buf, nread, &E.follow_open_row);
+		E.follow_off += nread;
+	}
+	
+	E.dirty = dirty;
+	if (at_end && E.numrows > 0 && E.cy < E.numrows - 1) {
+		E.cy = E.numrows - 1;
+		E.cx = 0;
+	}
+}
+
+// Drops all rows, used when the followed file gets truncated
+void editorFollowReset() {
+	editorClipboardEdit(0);
+	for (int j = 0; j < E.numrows; j++) editorFreeRow(&E.row[j]);
+	E.numrows = 0;
+	E.cx = E.cy = 0;
+	E.rowoff = E.coloff = E.wrapoff = 0;
+	E.ncursors = 0;
+	E.sel_mode = 0;
+	E.wrap_dirty = 1;
+	E.offset_dirty = 1;
+	editorDamage(0, INT_MAX);
+	E.follow_off = 0;
+	E.follow_open_row = 0;
+	E.crlf = 0;
+}
+
+// Opens the followed file by its name and starts watching it
+int editorFollowOpen() {
+	E.follow_fd = open(E.filename, O_RDONLY | O_CLOEXEC);
+	if (E.follow_fd == -1) return -1;
+	E.follow_wd = inotify_add_watch(E.follow_inotify, E.filename,
+		IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+	return 0;
+}
+
+void editorFollowHandler(int fd) {
+	char events[4096];
+	while (read(fd, events, sizeof(events)) > 0); // all events lead to the same checks
+	
+	// file could have grown before being rotated, so read the rest of it first
+	editorFollowRead();
+	
+	struct stat st, cur;
+	if (fstat(E.follow_fd, &cur) == -1) return;
+	if (stat(E.filename, &st) == 0 && (st.st_ino != cur.st_ino || st.st_dev != cur.st_dev)) {
+		inotify_rm_watch(E.follow_inotify, E.follow_wd);
+		close(E.follow_fd);
+		if (editorFollowOpen() == -1) {
+			editorSetStatusMessage("Can't follow %s: %s", E.filename, strerror(errno));
+			editorToggleFollow();
+			return;
+		}
+		E.follow_off = 0;
+		E.follow_open_row = 0;
+		editorSetStatusMessage("%s was rotated", E.filename);
+		editorFollowRead();
+	} else if (cur.st_size < E.follow_off) {
+		editorFollowReset();
+		editorSetStatusMessage("%s was truncated", E.filename);
+		editorFollowRead();
+	}
+}
+
+void editorToggleFollow() {
+	if (E.follow) {
+		editorRemoveWatch(E.follow_inotify);
+		close(E.follow_inotify);
+		close(E.follow_fd);
+		E.follow = 0;
+		editorSetStatusMessage("Follow mode off");
+		return;
+	}
+	
+	if (E.filename == NULL || E.pager || E.codec) {
+		if (E.filename == NULL) editorSetStatusMessage("Nothing to follow");
+		else editorSetStatusMessage("Can't follow a %s file", E.pager ? "paged" : "compressed");
+		return;
+	}
+	
+	E.follow_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (E.follow_inotify == -1 || editorFollowOpen() == -1) {
+		editorSetStatusMessage("Can't follow %s: %s", E.filename, strerror(errno));
+		if (E.follow_inotify != -1) close(E.follow_inotify);
+		return;
+	}
+	
+	// the directory is watched to notice the file being replaced by a new one
+	char *dir = strdup(E.filename);
+	char *slash = strrchr(dir, '/');
+	if (slash) *(slash == dir ? slash + 1 : slash) = '\0';
+	inotify_add_watch(E.follow_inotify, slash ? dir : ".", IN_CREATE | IN_MOVED_TO);
+	free(dir);
+	
+	// continue from the end of what was already loaded
+	struct stat st;
+	char last = '\n';
+	fstat(E.follow_fd, &st);
+	E.follow_off = st.st_size;
+	if (E.follow_off > 0 && pread(E.follow_fd, &last, 1, E.follow_off - 1) != 1) last = '\n';
+	E.follow_open_row = (last != '\n');
+	
+	E.follow = 1;
+	editorAddWatch(E.follow_inotify, editorFollowHandler);
+	editorSetStatusMessage("Following %s", E.filename);
+}
+
+
+/*** change detection ***/
+
+// Directories of opened files are watched by one inotify instance shared by all buffers. When a file
+// gets changed by another program, saving it asks for confirmation and reloading it replaces only the
+// rows which differ, so highlight of the rest is kept.
+
+int diskwatch = -1; // inotify instance, -1 until some file is watched
+
+// Tells whether the file still is as it was last loaded or saved
+int editorDiskUnchanged(struct stat *st) {
+	return st->st_ino == E.disk_stat.st_ino && st->st_dev == E.disk_stat.st_dev && st->st_size == E.disk_stat.st_size &&
+		st->st_mtim.tv_sec == E.disk_stat.st_mtim.tv_sec && st->st_mtim.tv_nsec == E.disk_stat.st_mtim.tv_nsec;
+}
+
+// Checks the file of the active buffer after its directory reported a change
+void editorDiskCheck() {
+	struct stat st;
+	if (E.follow || E.save || E.disk_changed) return; // follow mode keeps up with the changes itself
+	if (stat(E.filename, &st) == -1) {
+		E.disk_changed = 1;
+		editorSetStatusMessage("%s was removed by another program", E.filename);
+	} else if (!editorDiskUnchanged(&st)) {
+		E.disk_changed = 1;
+		if (E.codec) editorSetStatusMessage("%s was changed by another program", E.filename);
+		else editorSetStatusMessage("%s was changed by another program, Ctrl-L reloads it", E.filename);
+	}
+}
+
+void editorDiskHandler(int fd) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	int active = curbuf;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		struct inotify_event *ev;
+		for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+			ev = (struct inotify_event *)p;
+			if (ev->len == 0) continue;
+			for (int j = 0; j < nbuffers; j++) {
+				editorBufferActivate(j);
+				if (E.disk_wd != ev->wd) continue;
+				const char *slash = strrchr(E.filename, '/');
+				if (!strcmp(slash ? slash + 1 : E.filename, ev->name)) editorDiskCheck();
 			}
 		}
-		close(fd);
 	}
-	free(buf);
-	editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+	editorBufferActivate(active);
 }
 
+// Starts watching for changes of the file of the active buffer
+void editorDiskWatch() {
+	if (diskwatch == -1) {
+		diskwatch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (diskwatch == -1) return;
+		editorAddWatch(diskwatch, editorDiskHandler);
+	}
+	char *dir = strdup(E.filename);
+	char *slash = strrchr(dir, '/');
+	if (slash) *(slash == dir ? slash + 1 : slash) = '\0';
+	E.disk_wd = inotify_add_watch(diskwatch, slash ? dir : ".", IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+	E.disk_changed = 0;
+	free(dir);
+}
 
-/*** find ***/
+// Stops watching the file of the active buffer, the directory stays watched while other buffers need it
+void editorDiskForget() {
+	if (E.disk_wd == -1) return;
+	int shared = 0;
+	for (int j = 0; j < nbuffers; j++)
+		if (j != curbuf && buffers[j].disk_wd == E.disk_wd) shared = 1;
+	if (!shared) inotify_rm_watch(diskwatch, E.disk_wd);
+	E.disk_wd = -1;
+}
 
-void editorFindCallback(char *query, int key) {
-	static int last_match = -1;
-	static int direction = 1;
-	
-	static int saved_hl_line;
-	static char *saved_hl = NULL;
-	
-	if (saved_hl) {
-		memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-		free(saved_hl);
-		saved_hl = NULL;
+// Line of the file ending at end, which is either a newline or the end of the file
+size_t editorReloadLine(const char *data, const char *end, const char **start) {
+	const char *nl = end > data ? memrchr(data, '\n', end - data) : NULL;
+	*start = nl ? nl + 1 : data;
+	size_t len = end - *start;
+	while (len > 0 && (*start)[len - 1] == '\r') {
+		len--;
+		E.crlf = 1;
+	}
+	return len;
+}
+
+int editorReloadSame(erow *row, const char *line, size_t len) {
+	return (size_t)row->size == len && !memcmp(row->chars, line, len);
+}
+
+// Reads the file again, rows matching the start and the end of it are kept and only the ones between
+// them are replaced
+void editorReload() {
+	if (E.filename == NULL || E.pager || E.codec || E.readonly) {
+		editorSetStatusMessage("Can't reload %s", E.filename ? E.filename : "unnamed buffer");
+		return;
+	}
+	if (E.save) {
+		editorSetStatusMessage("Can't reload while the file is being saved");
+		return;
+	}
+	if (E.filter_pid) {
+		editorSetStatusMessage("Can't reload while rows are being filtered");
+		return;
 	}
 	
-	if (key == '\r' || key == '\x1b') {
-		last_match = -1;
-		direction = 1;
-		if (key == '\x1b') editorSetStatusMessage("Search Cancelled");
+	struct stat st;
+	int fd = open(E.filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		editorSetStatusMessage("Can't reload %s: %s", E.filename, strerror(errno));
+		if (fd != -1) close(fd);
 		return;
-	} else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-		direction = 1;
-	} else if (key == ARROW_LEFT || key == ARROW_UP) {
-		direction = -1;
-	} else {
-		last_match = -1;
-		direction = 1;
 	}
+	const char *data = "";
+	if (st.st_size > 0) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) die("mmap");
+	}
+	close(fd);
+	const char *end = data + st.st_size;
+	E.crlf = 0; // every line of the file is looked at below
 	
-	if (last_match == -1) direction = 1;
-	int current = last_match;
-	int i;
-	for (i = 0; i < E.numrows; i++) {
-		current += direction;
-		if (current == -1) current = E.numrows - 1;
-		else if (current == E.numrows) current = 0;
-		
-		/* TO DO */
-		/* Right now search only finds first occurence on each line, that means it can't locate two substring on signle line */
-		
-		erow *row = &E.row[current];
-		char *match = strstr(row->render, query);
-		if (match) {
-			last_match = current;
-			E.cy = current;
-			E.cx = editorRowRxToCx(row, match - row->render);
-			E.rowoff = E.numrows;
-			
-			saved_hl_line = current;
-			saved_hl = malloc(row->rsize);
-			memcpy(saved_hl, row->hl, row->rsize);
-			memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-			break;
-		}
+	// rows at the start which didn't change
+	int prefix = 0;
+	const char *p = data;
+	while (p < end && prefix < E.numrows) {
+		const char *nl = memchr(p, '\n', end - p);
+		const char *next = nl ? nl + 1 : end;
+		const char *start;
+		size_t len = editorReloadLine(p, nl ? nl : end, &start);
+		if (!editorReloadSame(&E.row[prefix], start, len)) break;
+		prefix++;
+		p = next;
 	}
-}
-
-void editorFind() {
-	int saved_cx = E.cx;
-	int saved_cy = E.cy;
-	int saved_coloff = E.coloff;
-	int saved_rowoff = E.rowoff;
 	
-	char *query = editorPrompt("Search: %s (Use ECS/Enter/Arrows)", 
-								editorFindCallback);
+	// rows at the end which didn't change, the last line of the file may lack its newline
+	int suffix = 0;
+	const char *q = end;
+	const char *eol = (end > data && end[-1] == '\n') ? end - 1 : end;
+	while (q > p && suffix < E.numrows - prefix) {
+		const char *start;
+		size_t len = editorReloadLine(p, eol, &start);
+		if (!editorReloadSame(&E.row[E.numrows - 1 - suffix], start, len)) break;
+		suffix++;
+		q = start;
+		eol = start - 1;
+	}
 	
-	if (query) {
-		free(query);
-	} else {
-		E.cx = saved_cx;
-		E.cy = saved_cy;
-		E.coloff = saved_coloff;
-		E.rowoff = saved_rowoff;
+	// rows between them are replaced by lines of the file between them
+	int lines = 0;
+	for (const char *r = p; r < q; lines++) {
+		const char *nl = memchr(r, '\n', q - r);
+		r = nl ? nl + 1 : q;
 	}
+	int old = E.numrows - prefix - suffix;
+	editorClipboardEdit(prefix);
+	for (int j = prefix; j < prefix + old; j++) editorFreeRow(&E.row[j]);
+	if (lines > old) E.row = realloc(E.row, sizeof(erow) * (E.numrows - old + lines));
+	memmove(&E.row[prefix + lines], &E.row[prefix + old], sizeof(erow) * suffix);
+	for (int j = prefix; j < prefix + lines; j++) {
+		const char *nl = memchr(p, '\n', q - p);
+		const char *start;
+		size_t len = editorReloadLine(p, nl ? nl : q, &start);
+		editorInitRow(&E.row[j], j, start, len);
+		editorRenderRow(&E.row[j]);
+		p = nl ? nl + 1 : q;
+	}
+	E.numrows += lines - old;
+	for (int j = prefix + lines; j < E.numrows; j++) E.row[j].idx = j;
+	if (suffix > 0 && (lines > 0 || old > 0)) {
+		// the first kept row may start in another state now
+		E.row[prefix + lines].hl_valid = 0;
+		if (E.row[prefix + lines].ckpt) E.row[prefix + lines].ckpt_dirty = 1;
+	}
+	if (st.st_size > 0) munmap((void *)data, st.st_size);
+	
+	// rows now match the file
+	for (int j = 0; j < E.numrows; j++) E.row[j].saved_size = E.row[j].size;
+	if (E.cy > E.numrows) E.cy = E.numrows;
+	if (E.cy < E.numrows && E.cx > E.row[E.cy].size) E.cx = E.row[E.cy].size;
+	E.wrap_dirty = 1;
+	E.offset_dirty = 1;
+	if (lines > 0 || old > 0) editorDamage(prefix, lines == old ? prefix + lines - 1 : INT_MAX);
+	E.dirty = 0;
+	E.mod_from = INT_MAX;
+	E.mod_to = -1;
+	E.mod_rows = 0;
+	E.disk_stat = st;
+	E.disk_valid = editorDiskMatches(st.st_size);
+	E.disk_changed = 0;
+	editorJournalReset(NULL, 0);
+	editorSetStatusMessage("Reloaded %s, %d lines replaced by %d", E.filename, old, lines);
 }
 
 
@@ -553,17 +4154,22 @@ void editorFind() {
 struct abuf {
 	char *b;
 	int len;
+	int cap; // allocated size -- grows geometrically so building a frame needs only a few reallocs
 };
 
-#define ABUF_INIT {NULL, 0}
+#define ABUF_INIT {NULL, 0, 0}
 
 // everything to be displayed has to be parsed into the buffer first
 void abAppend(struct abuf *ab, const char *s, int len) {
-	char *new = realloc(ab->b, ab->len + len);
-	
-	if (new == NULL) return;
-	memcpy(&new[ab->len], s, len);
-	ab->b = new;
+	if (ab->len + len > ab->cap) {
+		int cap = ab->cap ? ab->cap : 4096;
+		while (cap < ab->len + len) cap *= 2;
+		char *new = realloc(ab->b, cap);
+		if (new == NULL) return;
+		ab->b = new;
+		ab->cap = cap;
+	}
+	memcpy(&ab->b[ab->len], s, len);
 	ab->len += len;
 }
 
@@ -574,32 +4180,60 @@ void abFree(struct abuf *ab) {
 
 /*** -highlighting- ***/
 
-void editorHighlightChar(struct abuf *ab, const char *s, const char *format) {
-	
-	// int format_len = 0;
-	// while (format[format_len]) format_len++;
-	
-	abAppend(ab, format, 5);
-	abAppend(ab, s, 1);
-	if (format[2] == '4') abAppend(ab, "\x1b[49m", 5);
-	else abAppend(ab, "\x1b[39m", 5);
-	
+#define HL_ENTRIES (HL_CUSTOM + 1)
+
+// SGR escape sequences of every highlight class -- built once, so drawing doesn't call snprintf per character
+char hl_sgr[HL_ENTRIES][24];
+int hl_sgr_len[HL_ENTRIES];
+
+void editorInitSyntaxColors() {
+	for (int hl = 0; hl < HL_ENTRIES; hl++) {
+		int color_fg, color_bg, effect;
+		editorSyntaxToColor(hl, &color_fg, &color_bg, &effect);
+		
+		char *buf = hl_sgr[hl];
+		int size = sizeof(hl_sgr[hl]);
+		int clen = snprintf(buf, size, "\x1b[m");
+		if (hl != HL_NORMAL) {
+			clen += snprintf(buf + clen, size - clen, "\x1b[");
+			if (effect > 0) clen += snprintf(buf + clen, size - clen, "%d;", effect);
+			if (color_bg > 0) clen += snprintf(buf + clen, size - clen, "%d;", color_bg);
+			clen += snprintf(buf + clen, size - clen, "%dm", color_fg);
+		}
+		hl_sgr_len[hl] = clen;
+	}
 }
 
-void editorHighlightString(struct abuf *ab, const char *s, const char *format) {
-	
-	// int format_len = 0;
-	int string_len = 0;
-	// while (format[format_len]) format_len++;
-	while (s[string_len]) string_len++; 
-	
-	if (string_len <= 1) editorHighlightChar(ab, s, format);
-	
-	abAppend(ab, format, 5);
-	abAppend(ab, s, string_len);
-	if (format[2] == '4') abAppend(ab, "\x1b[49m", 5);
-	else abAppend(ab, "\x1b[39m", 5);
-	
+// SWAR helpers -- test 8 bytes at once for a byte smaller than n (n <= 128) or equal to n
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+#define swarHasLess(x, n) (((x) - SWAR_ONES * (n)) & ~(x) & SWAR_HIGHS)
+#define swarHasByte(x, n) swarHasLess((x) ^ (SWAR_ONES * (n)), 1)
+
+// Returns index of the first control character in s or len if there is none
+int editorFindCtrl(const char *s, int len) {
+	int i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t x;
+		memcpy(&x, &s[i], 8);
+		if (swarHasLess(x, 0x20) || swarHasByte(x, 0x7f)) break;
+	}
+	for (; i < len; i++)
+		if ((unsigned char)s[i] < 0x20 || s[i] == 0x7f) return i;
+	return len;
+}
+
+// Returns length of the run of equal highlight classes at the start of hl
+int editorHighlightRun(const unsigned char *hl, int len) {
+	uint64_t pattern = SWAR_ONES * hl[0];
+	int i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t x;
+		memcpy(&x, &hl[i], 8);
+		if (x != pattern) break;
+	}
+	while (i < len && hl[i] == hl[0]) i++;
+	return i;
 }
 
 
@@ -607,11 +4241,25 @@ void editorHighlightString(struct abuf *ab, const char *s, const char *format) {
 
 // Controls scrolling of text based on cursor position
 void editorScroll() {
+	if (E.pager) editorPagerScroll();
+	
 	E.rx = 0;
 	if (E.cy < E.numrows) {
 		E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
 	}
 	
+	if (E.softwrap) {
+		editorWrapIndex();
+		E.coloff = 0;
+		long long top = editorWrapLine(E.rowoff) + E.wrapoff;
+		long long cur = editorWrapLine(E.cy) + E.rx / editorTextCols();
+		if (cur < top) top = cur;
+		if (cur >= top + E.screenrows) top = cur - E.screenrows + 1;
+		editorWrapLocate(top, &E.rowoff, &E.wrapoff);
+		return;
+	}
+	E.wrapoff = 0;
+	
 	if (E.cy < E.rowoff) {
 		E.rowoff = E.cy;
 	}
@@ -621,137 +4269,320 @@ void editorScroll() {
 	if (E.rx < E.coloff) {
 		E.coloff = E.rx;
 	}
-	if (E.rx >= E.coloff + E.screencols) {
-		E.coloff = E.rx - E.screencols + 1;
+	if (E.rx >= E.coloff + editorTextCols()) {
+		E.coloff = E.rx - editorTextCols() + 1;
+	}
+}
+
+// Draws a control character, or a byte which isn't valid UTF-8, as a highlighted symbol
+void editorDrawSymbol(struct abuf *ab, char c) {
+	char sym = ((unsigned char)c <= 26) ? '@' + c : '?';
+	abAppend(ab, "\x1b[7m", 4);
+	abAppend(ab, &sym, 1);
+	abAppend(ab, "\x1b[m", 3);
+}
+
+// Draws width columns of a row with characters other than ASCII starting at rendered position rx.
+// Wide characters cut by either edge are drawn as spaces.
+int editorDrawRowSegmentUtf8(struct abuf *ab, erow *row, int rx, int width) {
+	const char *c = row->render;
+	unsigned char *hl = row->hl;
+	int len = row->rsize;
+	int col = row->roff;
+	int j = 0;
+	
+	// skip to the first character ending after rx, combining ones belong to the character before them
+	while (j < len) {
+		int n;
+		int w = utf8CharWidth(&c[j], len - j, &n);
+		if (col + w > rx) break;
+		col += w;
+		j += n;
+	}
+	int drawn = 0;
+	if (col < rx && j < len) {
+		int n;
+		drawn = col + utf8CharWidth(&c[j], len - j, &n) - rx;
+		if (drawn > width) drawn = width;
+		for (int k = 0; k < drawn; k++) abAppend(ab, " ", 1);
+		j += n;
+	}
+	
+	// Drawing the row in runs of printable characters sharing the same highlight
+	int current_hl = HL_NORMAL;
+	int run = j; // start of the run not drawn yet
+	#define DRAW_RUN() do { \
+		if (j > run) { \
+			if (hl[run] != current_hl) { \
+				current_hl = hl[run]; \
+				abAppend(ab, hl_sgr[current_hl], hl_sgr_len[current_hl]); \
+			} \
+			abAppend(ab, &c[run], j - run); \
+		} \
+	} while (0)
+	while (j < len && drawn < width) {
+		unsigned int cp;
+		int n = utf8Decode(&c[j], len - j, &cp);
+		int w = n ? utf8Width(cp) : 1;
+		if (drawn + w > width) break;
+		if (n == 0 || cp < 0x20 || (cp >= 0x7f && cp < 0xa0) || hl[j] != hl[run]) DRAW_RUN();
+		if (n == 0 || cp < 0x20 || (cp >= 0x7f && cp < 0xa0)) {
+			// C1 controls are unsafe to send to the terminal as well
+			editorDrawSymbol(ab, n == 1 ? c[j] : '?');
+			current_hl = HL_NORMAL;
+			j += n ? n : 1;
+			run = j;
+		} else {
+			if (hl[j] != hl[run]) run = j;
+			j += n;
+		}
+		drawn += w;
+	}
+	DRAW_RUN();
+	#undef DRAW_RUN
+	for (; drawn < width && j < len; drawn++) abAppend(ab, " ", 1); // wide character cut by the right edge
+	abAppend(ab, "\x1b[m", 3);
+	return drawn;
+}
+
+// Draws width columns of the row starting at rendered position rx, returns how many were drawn
+int editorDrawRowSegment(struct abuf *ab, erow *row, int rx, int width) {
+	editorRowPrepareWindow(row, rx, width);
+	if (row->rutf8) return editorDrawRowSegmentUtf8(ab, row, rx, width);
+	int len = row->roff + row->rsize - rx;
+	if (len < 0) len = 0;
+	if (len > width) len = width;
+	char *c = &row->render[rx - row->roff];
+	unsigned char *hl = &row->hl[rx - row->roff];
+	int current_hl = HL_NORMAL;
+	int ctrl = editorFindCtrl(c, len);
+	int j = 0;
+	
+	// Drawing the row in runs of characters sharing the same highlight
+	while (j < len) {
+		
+		// Non-printable characters
+		if (j == ctrl) {
+			editorDrawSymbol(ab, c[j]);
+			current_hl = HL_NORMAL;
+			j++;
+			ctrl = j + editorFindCtrl(&c[j], len - j);
+			continue;
+		}
+		
+		int run = editorHighlightRun(&hl[j], ctrl - j);
+		if (hl[j] != current_hl) {
+			current_hl = hl[j];
+			abAppend(ab, hl_sgr[current_hl], hl_sgr_len[current_hl]);
+		}
+		abAppend(ab, &c[j], run);
+		j += run;
+	}
+	abAppend(ab, "\x1b[m", 3);
+	return len;
+}
+
+// Draws extra cursors of the row as inverted cells, the screen line shows width columns of it from rx on
+void editorDrawCursors(struct abuf *ab, struct editorWindow *w, int y, erow *row, int rx, int left, int width) {
+	int lo = 0, hi = E.ncursors;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (E.cursors[mid].cy < row->idx) lo = mid + 1;
+		else hi = mid;
+	}
+	for (int j = lo; j < E.ncursors && E.cursors[j].cy == row->idx; j++) {
+		int cx = E.cursors[j].cx;
+		if (cx > row->size) continue;
+		int col = editorRowCxToRx(row, cx) - rx;
+		if (col < 0 || col >= width) continue;
+		
+		char pos[32];
+		snprintf(pos, sizeof(pos), "\x1b[%d;%dH\x1b[7m", w->top + y + 1, w->left + left + col + 1);
+		abAppend(ab, pos, strlen(pos));
+		unsigned int cp;
+		int n = utf8Decode(&row->chars[cx], row->size - cx, &cp);
+		if (n && cp >= 0x20 && (cp < 0x7f || cp >= 0xa0) && utf8Width(cp) > 0 && col + utf8Width(cp) <= width)
+			abAppend(ab, &row->chars[cx], n);
+		else
+			abAppend(ab, " ", 1);
+		abAppend(ab, "\x1b[m", 3);
 	}
 }
 
-// Resposible for drawing every row in a file
-void editorDrawRows(struct abuf *ab) {
+// Draws the row like editorDrawRowSegment, with the selected part of it highlighted
+int editorDrawRowSelected(struct abuf *ab, erow *row, int rx, int width) {
+	int from, to;
+	if (!E.sel_mode || !editorSelectionColumns(row, &from, &to) || to <= rx || from >= rx + width)
+		return editorDrawRowSegment(ab, row, rx, width);
+	
+	// highlight of the render is swapped for the time of drawing
+	editorRowPrepareWindow(row, rx, width);
+	if (from < row->roff) from = row->roff;
+	int a = editorRenderOffset(row, from);
+	int b = (to >= row->roff + row->rcols) ? row->rsize : editorRenderOffset(row, to);
+	if (a < 0) a = 0;
+	if (b > row->rsize) b = row->rsize;
+	if (a >= b) return editorDrawRowSegment(ab, row, rx, width);
+	unsigned char *saved = malloc(b - a);
+	memcpy(saved, &row->hl[a], b - a);
+	memset(&row->hl[a], HL_SELECT, b - a);
+	int drawn = editorDrawRowSegment(ab, row, rx, width);
+	memcpy(&row->hl[a], saved, b - a);
+	free(saved);
+	return drawn;
+}
+
+// Resposible for drawing every row in a file -- rows are only drawn if they changed since the window
+// was last drawn, unless its viewport changed
+void editorDrawRows(struct abuf *ab, struct editorWindow *w) {
+	int full = !w->drawn || w->last_buffer != E.id || w->last_rowoff != E.rowoff ||
+		w->last_coloff != E.coloff || w->last_wrapoff != E.wrapoff ||
+		w->last_numline != E.show_numline || w->last_softwrap != E.softwrap;
+	int textcols = editorTextCols();
+	int numline = E.screencols - textcols;
+	
 	int y;
+	int filerow = E.rowoff;
+	int sub = E.wrapoff; // wrapped line of filerow when soft wrapping
 	for (y = 0; y < E.screenrows; y++) {
-		int filerow = y + E.rowoff;
-		if (filerow >= E.numrows) {
-			// Drawing empty lines
-			if (E.numrows == 0 && y == E.screenrows / 3) {
-				
-				// Welcome string
-				char welcome[80];
-				int welcomelen = snprintf(welcome, sizeof(welcome),
-					"Hecto editor -- version %s", HECTO_VERSION);
-				if (welcomelen > E.screencols) welcomelen = E.screencols;
-				int padding = (E.screencols - welcomelen) / 2;
-				if (padding) {
+		erow *row = (filerow < E.numrows) ? &E.row[filerow] : NULL;
+		if (row) editorSyntaxEnsure(filerow);
+		
+		// rows below a changed one move when soft wrapping
+		int damaged = full || (filerow >= E.damage_from && (filerow <= E.damage_to || E.softwrap));
+		if (damaged) {
+			char pos[32];
+			snprintf(pos, sizeof(pos), "\x1b[%d;%dH", w->top + y + 1, w->left + 1);
+			abAppend(ab, pos, strlen(pos));
+			int width = 0;
+			
+			if (!row) {
+				// Drawing empty lines
+				if (E.numrows == 0 && y == E.screenrows / 3) {
+					
+					// Welcome string
+					char welcome[80];
+					int welcomelen = snprintf(welcome, sizeof(welcome),
+						"Hecto editor -- version %s", HECTO_VERSION);
+					if (welcomelen > E.screencols) welcomelen = E.screencols;
+					int padding = (E.screencols - welcomelen) / 2;
+					width = padding + welcomelen;
+					if (padding) {
+						abAppend(ab, "~", 1);
+						padding--;
+					}
+					while (padding--) abAppend(ab, " ", 1);
+					abAppend(ab, welcome, welcomelen);
+					
+				} else {
+					// Empty line character 
 					abAppend(ab, "~", 1);
-					padding--;
+					width = 1;
 				}
-				while (padding--) abAppend(ab, " ", 1);
-				abAppend(ab, welcome, welcomelen);
 				
 			} else {
-				// Empty line character 
-				abAppend(ab, "~", 1);
-			}
-			
-		} else {
-			if (E.show_numline) {
-				char buf[8];
-				snprintf(buf, sizeof(buf), "%4d | ", filerow);
-				abAppend(ab, "\x1b[34m", 5);
-				abAppend(ab, buf, 7);
-				abAppend(ab, "\x1b[m", 3);
+				if (numline) {
+					char buf[8];
+					if (sub == 0) snprintf(buf, sizeof(buf), "%4d | ", filerow);
+					else snprintf(buf, sizeof(buf), "     | ");
+					abAppend(ab, "\x1b[34m", 5);
+					abAppend(ab, buf, 7);
+					abAppend(ab, "\x1b[m", 3);
+					width = numline;
+				}
 				
+				// Drawing file lines
+				if (E.softwrap) width += editorDrawRowSelected(ab, row, sub * textcols, textcols);
+				else width += editorDrawRowSelected(ab, row, E.coloff, textcols);
 			}
 			
-			
-			// Drawing file lines
-			int len = E.row[filerow].rsize - E.coloff;
-			if (len < 0) len = 0;
-			if (len > E.screencols) len = E.screencols;
-			char *c = &E.row[filerow].render[E.coloff];
-			unsigned char *hl = &E.row[filerow].hl[E.coloff];
-			int current_bg_color = -1;
-			int current_fg_color = -1;
-			int current_effect = -1;
-			int j;
-			
-			// Drawing individual characters of the row
-			for (j = 0; j < len; j++) {
-				
-				// Non-printanle characters
-				if (iscntrl(c[j])) {
-					char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-					abAppend(ab, "\x1b[7m", 4);
-					abAppend(ab, &sym, 1);
-					abAppend(ab, "\x1b[m", 3);
-					if (current_bg_color != -1 || current_effect != -1) {
-						abAppend(ab, "\x1b[m", 3);
-						current_bg_color = -1;
-						current_effect = -1;
-					}
-					if (current_fg_color != -1) {
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_fg_color);
-						abAppend(ab, buf, clen);
-					}
-				
-				// Normal characters
-				} else if (hl[j] == HL_NORMAL) {
-					if (current_bg_color != -1 || current_effect != -1) {
-						abAppend(ab, "\x1b[m", 3);
-						current_bg_color = -1;
-						current_effect = -1;
-					}
-					if (current_fg_color != -1) {
-						abAppend(ab, "\x1b[39m", 5);
-						current_fg_color = -1;
-					}
-					abAppend(ab, &c[j], 1);
-					
-				// Syntax highlighing
-				} else {
-					
-					int color_fg, color_bg, effect;
-					editorSyntaxToColor(hl[j], &color_fg, &color_bg, &effect);
-					if (color_fg != current_fg_color || effect != current_effect || color_bg != current_bg_color) {
-						current_fg_color = color_fg;
-						current_bg_color = color_bg;
-						current_effect = effect;
-						char buf[32];
-						int clen = snprintf(buf, sizeof(buf), "\x1b[m\x1b[");
-						if (effect > 0) clen += snprintf((buf + clen), sizeof(buf) - clen, "%d;", effect);
-						if (color_bg > 0) clen += snprintf((buf + clen), sizeof(buf) - clen, "%d;" , color_bg);
-						clen += snprintf((buf + clen), sizeof(buf) - clen, "%dm" , color_fg);
-						abAppend(ab, buf, clen);
-					}
-					abAppend(ab, &c[j], 1);
-				}
+			// Clear rest of the line, windows on the left can't clear to the end of the screen
+			if (w->left + w->cols == termcols) {
+				abAppend(ab, "\x1b[K", 3);
+			} else {
+				while (width++ < E.screencols) abAppend(ab, " ", 1);
 			}
-			abAppend(ab, "\x1b[m", 5);
+			if (row && E.ncursors)
+				editorDrawCursors(ab, w, y, row, E.softwrap ? sub * textcols : E.coloff, numline, textcols);
 		}
 		
-		// Move cursor to the upper-left corner and append new line
-		abAppend(ab, "\x1b[K", 3);
-		abAppend(ab, "\r\n", 2);
+		if (row && E.softwrap && ++sub < editorWrapHeight(row)) continue;
+		sub = 0;
+		filerow++;
+	}
+	
+	w->drawn = 1;
+	w->last_buffer = E.id;
+	w->last_rowoff = E.rowoff;
+	w->last_coloff = E.coloff;
+	w->last_wrapoff = E.wrapoff;
+	w->last_numline = E.show_numline;
+	w->last_softwrap = E.softwrap;
+}
+
+// Draws separators between windows split side by side
+void editorDrawSplits(struct abuf *ab, struct editorWindow *w) {
+	if (!w->split) return;
+	if (w->split == 'v' && !w->drawn) {
+		for (int y = 0; y < w->rows; y++) {
+			char pos[32];
+			snprintf(pos, sizeof(pos), "\x1b[%d;%dH\x1b[7m \x1b[m", w->top + y + 1, w->second->left);
+			abAppend(ab, pos, strlen(pos));
+		}
 	}
+	w->drawn = 1;
+	editorDrawSplits(ab, w->first);
+	editorDrawSplits(ab, w->second);
 }
 
-// Draws status bar at the bottom of screen with file information
-void editorDrawStatusBar(struct abuf *ab) {
+
+// Draws status bar at the bottom of the window with file information
+void editorDrawStatusBar(struct abuf *ab, struct editorWindow *w) {
 	erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
 	
+	char pos[32];
+	snprintf(pos, sizeof(pos), "\x1b[%d;%dH", w->top + w->rows, w->left + 1);
+	abAppend(ab, pos, strlen(pos));
 	abAppend(ab, "\x1b[7m", 4);
 	
 	char status[80], rstatus[80];
 	
-	int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-		E.filename ? E.filename : "[No Name]", E.numrows,
-		E.dirty ? "(modified)" : "");
+	char tag[32] = "";
+	if (nbuffers > 1) snprintf(tag, sizeof(tag), "[%d/%d] ", curbuf + 1, nbuffers);
+	
+	int len, rlen;
+	if (E.pager) {
+		long long lines;
+		off_t scanned;
+		int done;
+		lineIndexProgress(E.pager_index, &lines, &scanned, &done);
+		long long line = editorPagerLine(E.cy < E.numrows ? E.cy : E.numrows);
+		char total[32];
+		if (done) snprintf(total, sizeof(total), "%lld", lines);
+		else snprintf(total, sizeof(total), "%lld+", lines);
 		
-	int rlen = snprintf(rstatus, sizeof(rstatus), "%s  |  Ln %d/%d, Col %d/%d",
-		E.syntax ? E.syntax->filetype : "-",
-		E.cy + 1, E.numrows, E.cx, row ? row->size : 0);
+		if (done) len = snprintf(status, sizeof(status), "%s%.20s - %s lines (read-only)",
+			tag, E.filename, total);
+		else len = snprintf(status, sizeof(status), "%s%.20s - %s lines (indexing %d%%)",
+			tag, E.filename, total, (int)(scanned * 100 / E.pager_size));
 		
+		char ln[32];
+		if (line >= 0) snprintf(ln, sizeof(ln), "%lld", line + 1);
+		else snprintf(ln, sizeof(ln), "?");
+		long long offset = E.pager_offs[E.cy < E.numrows ? E.cy : E.numrows] + E.cx;
+		rlen = snprintf(rstatus, sizeof(rstatus), "%s  |  Ln %s/%s, Col %d/%d, @%lld",
+			E.syntax ? E.syntax->filetype : "-",
+			ln, total, E.cx, row ? row->size : 0, offset);
+	} else {
+		len = snprintf(status, sizeof(status), "%s%.20s - %d lines %s",
+			tag, E.filename ? E.filename : "[No Name]", E.numrows,
+			E.dirty ? "(modified)" : "");
+			
+		rlen = snprintf(rstatus, sizeof(rstatus), "%s  |  Ln %d/%d, Col %d/%d, @%lld",
+			E.syntax ? E.syntax->filetype : "-",
+			E.cy + 1, E.numrows, E.cx, row ? row->size : 0, editorRowOffset(E.cy) + E.cx);
+	}
+			
 	if (len > E.screencols) len = E.screencols;
 	abAppend(ab, status, len);
 	while (len < E.screencols) {
@@ -765,14 +4596,15 @@ void editorDrawStatusBar(struct abuf *ab) {
 	}
 	
 	abAppend(ab, "\x1b[m", 3);
-	abAppend(ab, "\r\n", 2);
 }
 
-// Draws a message bar underneath the status bar
+// Draws a message bar at the bottom of the screen
 void editorDrawMessageBar(struct abuf *ab) {
-	abAppend(ab, "\x1b[K", 3);
+	char pos[32];
+	snprintf(pos, sizeof(pos), "\x1b[%d;1H\x1b[K", termrows);
+	abAppend(ab, pos, strlen(pos));
 	int msglen = strlen(E.statusmsg);
-	if (msglen > E.screencols) msglen = E.screencols;
+	if (msglen > termcols) msglen = termcols;
 	if (msglen && time(NULL) - E.statusmsg_time < 5)
 		abAppend(ab, E.statusmsg, msglen);
 }
@@ -788,20 +4620,43 @@ void editorSetStatusMessage(const char *fmt, ...) {
 
 // Main drawing function -- controls the order of other draw functions 
 void editorRefreshScreen() {
-	editorScroll();
-	
 	struct abuf ab = ABUF_INIT;
 	
 	abAppend(&ab, "\x1b[?25l", 6);
-	abAppend(&ab, "\x1b[H", 3);
 	
-	editorDrawRows(&ab);
-	editorDrawStatusBar(&ab);
+	// every window is drawn with its buffer and viewport loaded into E
+	struct editorWindow *active = win;
+	struct editorWindow *w = active;
+	editorWindowLeave();
+	do {
+		editorWindowEnter(w);
+		editorScroll();
+		editorDrawRows(&ab, w);
+		editorDrawStatusBar(&ab, w);
+		editorWindowLeave();
+		w = editorWindowNext(w);
+	} while (w != active);
+	editorDrawSplits(&ab, root);
+	editorWindowEnter(active);
+	
+	// changed rows were redrawn in all windows showing them
+	for (int j = 0; j < nbuffers; j++) {
+		struct editorConfig *b = (j == curbuf) ? &E : &buffers[j];
+		b->damage_from = INT_MAX;
+		b->damage_to = -1;
+	}
+	
 	editorDrawMessageBar(&ab);
 	
+	int y = E.cy - E.rowoff;
+	int x = E.rx - E.coloff;
+	if (E.softwrap) {
+		y = editorWrapLine(E.cy) + E.rx / editorTextCols() - (editorWrapLine(E.rowoff) + E.wrapoff);
+		x = E.rx % editorTextCols();
+	}
+	x += E.screencols - editorTextCols(); // past line numbers
 	char buf[32];
-	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1,
-											  (E.rx - E.coloff) + 1);
+	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", win->top + y + 1, win->left + x + 1);
 	abAppend(&ab, buf, strlen(buf));
 	
 	abAppend(&ab, "\x1b[?25h", 6);
@@ -824,6 +4679,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
 		editorSetStatusMessage(prompt, buf);
 		editorRefreshScreen();
 		
+		editorWaitInput();
 		int c = editorReadKey();
 		if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
 			if (buflen != 0) buf[--buflen] = '\0';
@@ -838,7 +4694,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
 				if (callback) callback(buf, c);
 				return buf;
 			}
-		} else if (!iscntrl(c) && c < 128) {
+		} else if ((c >= 0x20 && c < 0x7f) || (c >= CHAR_MIN && c < 0)) { // bytes of UTF-8 characters are negative
 			if (buflen == bufsize - 1) {
 				bufsize *= 2;
 				buf = realloc(buf, bufsize);
@@ -853,30 +4709,36 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
 // Moves cursor based on given key
 void editorMoveCursor(int key) {
 	erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+	int n;
 	
 	switch (key) {
 		case ARROW_LEFT:
 			if (E.cx != 0) {
-				E.cx--;
+				// combining characters are passed together with the one they're combined with
+				do E.cx = utf8Prev(row->chars, E.cx);
+				while (E.cx > 0 && utf8CharWidth(&row->chars[E.cx], row->size - E.cx, &n) == 0);
 			} else if (E.cy > 0) {
 				E.cy--;
 				E.cx = E.row[E.cy].size;
 			}
 			break;
 		case ARROW_DOWN:
-			if (E.cy < E.numrows)
+			if (E.softwrap) editorWrapMoveCursor(key);
+			else if (E.cy < E.numrows)
 				E.cy++;
 			break;
 		case ARROW_RIGHT:
 			if (row && E.cx < row->size) {
-				E.cx++;
+				do E.cx = utf8Next(row->chars, E.cx, row->size);
+				while (E.cx < row->size && utf8CharWidth(&row->chars[E.cx], row->size - E.cx, &n) == 0);
 			} else if (row && (E.cx >= row->size) && (E.cy < E.numrows - 1)) {
 				E.cx = 0;
 				E.cy++;
 			}
 			break;
 		case ARROW_UP:
-			if (E.cy != 0)
+			if (E.softwrap) editorWrapMoveCursor(key);
+			else if (E.cy != 0)
 				E.cy--;
 			break;
 	}
@@ -886,33 +4748,93 @@ void editorMoveCursor(int key) {
 	if (E.cx > rowlen) {
 		E.cx = rowlen;
 	}
-	
-	if (E.show_numline) E.cx += 7;
+	if (row && utf8Skip(row->chars, E.cx, row->size) != E.cx) // not inside of a character
+		E.cx = utf8Prev(row->chars, utf8Skip(row->chars, E.cx, row->size));
+}
+
+// Shows the next page of keys in the message bar, which only fits one screen line
+void editorHelp() {
+	static const char *pages[] = {
+		"Ctrl-S = save | Ctrl-O = open | Ctrl-L = reload | Ctrl-Q = quit",
+		"Ctrl-F = find | Ctrl-G = go to | Ctrl-R = numbers | Ctrl-W = wrap",
+		"Ctrl-Space = select | Ctrl-C/X/P = copy/cut/paste | Ctrl-U = filter",
+		"Ctrl-D = cursor below | Ctrl-A = cursors at matches | Ctrl-T = follow",
+		"Ctrl-B = buffer | Ctrl-E/V = split | Ctrl-N/K = next/close window",
+	};
+	static int page = 0;
+	int npages = sizeof(pages) / sizeof(pages[0]);
+	editorSetStatusMessage("HELP %d/%d: %s", page + 1, npages, pages[page]);
+	page = (page + 1) % npages;
 }
 
 // Processes pressed keys and special keys
 void editorProcessKeypress() {
-	erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
-	
 	static int quit_times = HECTO_QUIT_CONFIRM;
+	static int reload_confirm = 0;
 	
+	editorWaitInput();
 	int c = editorReadKey();
+	// background work run while waiting may have moved the rows
+	erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+	if (E.sel_mode) {
+		editorSelectionDamage();
+		if (editorSelectionEdit(c)) {
+			quit_times = HECTO_QUIT_CONFIRM;
+			reload_confirm = 0;
+			return;
+		}
+	}
+	int multi = E.ncursors > 0;
+	if (multi) editorCursorsDamage();
 	
 	switch (c) {
 		case '\r':
-			editorInsertNewLine();
+			if (multi) editorCursorsInsertNewLine();
+			else editorInsertNewLine();
 			break;
 			
 		case CTRL_KEY('q'):
 			if (E.dirty && quit_times > 0) {
-				editorSetStatusMessage("WARNING! File has unsaved changes. Press Ctrl-Q %d more times to confirm quit.", quit_times);
+				editorSetStatusMessage("WARNING! File has unsaved changes. Press Ctrl-Q %d more times to confirm %s.",
+					quit_times, nbuffers > 1 ? "close" : "quit");
 				quit_times--;
 				return;
 			}
+			if (nbuffers > 1) {
+				editorBufferClose();
+				break;
+			}
+			if (E.filter_pid) editorFilterStop(1);
+			editorSaveWait();
+			editorJournalStop();
 			clearScreen();
 			exit(0);
 			break;
 		
+		case CTRL_KEY('o'):
+			editorBufferOpen();
+			break;
+		
+		case CTRL_KEY('b'):
+			editorBufferSwitch((curbuf + 1) % nbuffers);
+			break;
+		
+		case CTRL_KEY('e'):
+			editorWindowSplit('h');
+			break;
+		
+		case CTRL_KEY('v'):
+			editorWindowSplit('v');
+			break;
+		
+		case CTRL_KEY('n'):
+			editorWindowSwitch();
+			break;
+		
+		case CTRL_KEY('k'):
+			editorWindowClose();
+			break;
+		
 		case CTRL_KEY('s'):
 			editorSave();
 			break;
@@ -924,20 +4846,36 @@ void editorProcessKeypress() {
 		case CTRL_KEY('r'):
 			/* TO DO */
 			E.show_numline = E.show_numline ? 0 : 1;
+			E.wrap_dirty = 1;
+			break;
+		
+		case CTRL_KEY('t'):
+			editorToggleFollow();
+			break;
+		
+		case CTRL_KEY('w'):
+			E.softwrap = E.softwrap ? 0 : 1;
+			E.wrap_dirty = 1;
 			break;
 			
 		case HOME_KEY:
-			E.cx = 0;
+			if (multi) editorCursorsMove(c);
+			else E.cx = 0;
 			break;
 		
 		case END_KEY:
-			if (E.cy < E.numrows)
+			if (multi) editorCursorsMove(c);
+			else if (E.cy < E.numrows)
 				E.cx = E.row[E.cy].size;
 			break;
 			
 		case BACKSPACE:
 		case CTRL_KEY('h'):
 		case DEL_KEY:
+			if (multi) {
+				editorCursorsDelChars(c == DEL_KEY);
+				break;
+			}
 			if (c == DEL_KEY) {
 				if ((!row) || ((E.cx >= row->size) && (E.cy >= E.numrows - 1))) break;
 				else editorMoveCursor(ARROW_RIGHT);
@@ -947,37 +4885,79 @@ void editorProcessKeypress() {
 		
 		case PAGE_DOWN:
 		case PAGE_UP:
-			{
-				if (c == PAGE_UP) {
-					E.cy = E.rowoff;
-				} else if (c == PAGE_DOWN) {
-					E.cy = E.rowoff + E.screenrows - 1;
-					if (E.cy > E.numrows) E.cy = E.numrows;
-				}
-				
-				int times = E.screenrows;
-				while (times--)
-					editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
-			}
+			editorPageMove(c == PAGE_UP ? -1 : 1);
+			break;
+		
+		case CTRL_KEY('g'):
+			editorGoto();
 			break;
 		
 		case ARROW_UP:
 		case ARROW_DOWN:
 		case ARROW_LEFT:
 		case ARROW_RIGHT:
-			editorMoveCursor(c);
+			if (multi) editorCursorsMove(c);
+			else editorMoveCursor(c);
+			break;
+		
+		case CTRL_KEY('d'):
+			editorCursorsAddBelow();
+			break;
+		
+		case CTRL_KEY('a'):
+			editorFindCursors();
+			break;
+		
+		case '\0': // Ctrl-Space
+			editorSelectStart();
+			break;
+		
+		case CTRL_KEY('c'):
+			editorSelectionCopyEnd();
+			break;
+		
+		case CTRL_KEY('x'):
+			editorSelectionCut();
+			break;
+		
+		case CTRL_KEY('p'):
+			editorPaste();
+			break;
+		
+		case CTRL_KEY('u'):
+			editorFilter();
+			break;
+		
+		case CTRL_KEY('z'):
+			editorHelp();
 			break;
 		
 		case CTRL_KEY('l'):
+			if (E.dirty && !reload_confirm) {
+				editorSetStatusMessage("WARNING! Reloading throws away unsaved changes. Press Ctrl-L again to confirm.");
+				reload_confirm = 1;
+				return;
+			}
+			editorReload();
+			E.ncursors = 0;
+			E.sel_mode = 0;
+			break;
+		
 		case '\x1b':
+			E.ncursors = 0;
+			E.sel_mode = 0;
 			break;
 		
 		default:
-			editorInsertChar(c);
+			if (multi) editorCursorsInsertChar(c);
+			else editorInsertChar(c);
 			break;
 	}
+	if (E.ncursors) editorCursorsDamage();
+	if (E.sel_mode) editorSelectionDamage();
 	
 	quit_times = HECTO_QUIT_CONFIRM;
+	reload_confirm = 0;
 }
 
 
@@ -985,34 +4965,149 @@ void editorProcessKeypress() {
 
 // Initiate main editor struct, which contains most of the used data
 void initEditor() {
-	E.cx = 0;
-	E.cy = 0;
-	E.rx = 0;
-	E.rowoff = 0;
-	E.coloff = 0;
-	E.numrows = 0;
-	E.row = NULL;
+	buffers = malloc(sizeof(struct editorConfig));
+	nbuffers = 1;
+	curbuf = 0;
+	editorBufferInit();
+	
 	E.show_numline = 0; // TO DO
-	E.dirty = 0;
-	E.filename = NULL;
 	E.statusmsg[0] = '\0';
 	E.statusmsg_time = 0;
-	E.syntax = NULL;
+	E.cache = 0;
+	
+	editorInitSyntaxColors();
 	
-	if (getWindowSize(&E.screenrows, &E.screencols) == -1) 
+	if (getWindowSize(&termrows, &termcols) == -1) 
 		die("getWindowSize");
-	E.screenrows -= 2;
+	root = win = editorWindowNew(NULL);
+	editorWindowLayout(root, 0, 0, termrows - 1, termcols);
+	E.screenrows = termrows - 2;
+	E.screencols = termcols;
+}
+
+// Measures how many bytes of the file get highlighted per second, lines are lexed like rows are
+// but nothing is displayed
+void editorBenchmark(char *filename) {
+	struct stat st;
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) die(filename);
+	const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) die("mmap");
+	close(fd);
+	
+	editorBufferInit();
+	E.filename = strdup(filename);
+	editorSelectSyntaxHighlight();
+	
+	int longest = 0;
+	for (const char *p = data, *end = data + st.st_size; p < end; ) {
+		const char *nl = memchr(p, '\n', end - p);
+		const char *next = nl ? nl + 1 : end;
+		if (next - p > longest) longest = next - p;
+		p = next;
+	}
+	unsigned char *hl = malloc(longest);
+	
+	// file is highlighted over and over for at least a second
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	long long bytes = 0;
+	double elapsed;
+	long long hits = 0, misses = 0;
+	do {
+		// every pass starts with an empty cache, so only rows repeated within the file hit it
+		hlCacheClear(&hlcache);
+		int state = LEX_INIT;
+		for (const char *p = data, *end = data + st.st_size; p < end; ) {
+			const char *nl = memchr(p, '\n', end - p);
+			int len = (nl ? nl : end) - p;
+			state = editorLexCarry(editorLexRow(p, len, hl, state));
+			p = nl ? nl + 1 : end;
+		}
+		bytes += st.st_size;
+		hits += hlcache.hits;
+		misses += hlcache.misses;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+	} while (elapsed < 1.0);
+	
+	printf("%s (%s): %lld bytes highlighted in %.3f s, %.1f MB/s\n", filename,
+		E.syntax ? E.syntax->filetype : "no syntax", bytes, elapsed, bytes / elapsed / (1 << 20));
+	if (hits + misses) printf("%.1f%% of rows highlighted from cache\n", 100.0 * hits / (hits + misses));
+	hlCacheClear(&hlcache);
+	free(hl);
+	munmap((void *)data, st.st_size);
 }
 
 int main(int argc, char *argv[]) 
 {
+	int follow = 0;
+	int pager = 0;
+	int cache = 0;
+	int bench = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "fpcby")) != -1) {
+		switch (opt) {
+			case 'f':
+				follow = 1;
+				break;
+			case 'p':
+				pager = 1;
+				break;
+			case 'c':
+				cache = 1;
+				break;
+			case 'b':
+				bench = 1;
+				break;
+			case 'y':
+				osc52 = 1;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-f] [-p] [-c] [-y] [+line] [file]\n       %s -b file\n", argv[0], argv[0]);
+				exit(1);
+		}
+	}
+	
+	// +N opens the file at line N
+	long long line = 0;
+	char *filename = NULL;
+	for (int j = optind; j < argc; j++) {
+		if (argv[j][0] == '+') line = strtoll(&argv[j][1], NULL, 10);
+		else filename = argv[j];
+	}
+	
+	// -b only measures highlighting speed
+	if (bench) {
+		if (!filename) {
+			fprintf(stderr, "Usage: %s -b file\n", argv[0]);
+			exit(1);
+		}
+		editorSyntaxInit();
+		editorBenchmark(filename);
+		return 0;
+	}
+	
 	enableRawMode();
+	signal(SIGPIPE, SIG_IGN); // commands the editor writes to may exit early
 	initEditor();
-	if (argc >= 2) {
-		editorOpen(argv[1]);
+	editorSyntaxInit();
+	E.pager = pager;
+	E.cache = cache;
+	if (filename) {
+		editorOpen(filename);
+		if (line > 0 && E.pager) {
+			E.pager_goto = line - 1;
+			editorPagerGotoPending();
+		} else if (line > 0) {
+			editorGotoRow(line - 1 < E.numrows ? line - 1 : E.numrows);
+		}
+		if (follow) editorToggleFollow();
 	}
 	
-	editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-F = find | Ctrl-R = toggle line numbers | Ctrl-Q = quit");
+	// messages about the opened file take precedence
+	if (E.statusmsg[0] == '\0')
+		editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-F = find | Ctrl-Q = quit | Ctrl-Z = more keys");
 	
 	while (1) {
 		editorRefreshScreen();
@@ -1,16 +1,7 @@
 #ifndef _HECTO_SYNTAX_H
 #define _HECTO_SYNTAX_H
 
-struct editorSyntax {
-	char *filetype;
-	char **filematch;
-	char **keywords;
-	char *singleline_comment_start;
-	char *multiline_comment_start;
-	char *multiline_comment_end;
-	char *custom_line_start;
-	int flags;
-};
+#include "syntaxfile.h"
 
 enum editorHighlight {
 	HL_NORMAL = 0,
@@ -25,9 +16,6 @@ enum editorHighlight {
 	HL_CUSTOM
 };
 
-#define HL_HIGHLIGHT_NUMBERS (1<<0)
-#define HL_HIGHLIGHT_STRINGS (1<<1)
-
 
 char *C_HL_extensions[] = { ".c", ".h", NULL };
 char *C_HL_keywords[] = {
@@ -38,7 +26,7 @@ char *C_HL_keywords[] = {
 	"thread_local", "true", "typedef", "typeof", "typeof_unqual", "union",
 	"void", "volatile", "while",
 	
-	"int|", "long|", "double|", "float|", "char|", "unsinged|", "signed|",
+	"int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
 	"void|", NULL
 };
 
@@ -58,18 +46,19 @@ char *Cpp_HL_keywords[] = {
         "void", "volatile", "while", "xor", "xor_eq",
         
  	"char|", "char8_t|", "char16_t|", "char32_t|", "wchar_t|",        
-	"int|", "long|", "double|", "float|", "char|", "unsinged|", "signed|",
+	"int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
         "void|", NULL
 };
 
 char *Go_HL_extensions[] = { ".go", NULL };
+char *Go_HL_raw_strings[] = { "`", NULL };
 char *Go_HL_keywords[] = {
 	"break", "default", "func", "interface", "select", "case",
 	"defer", "go", "map", "struct", "chan", "else", "goto", "package",
-	"switch", "const", "falltrough", "if", "range", "type", "continue",
+	"switch", "const", "fallthrough", "if", "range", "type", "continue",
 	"for", "import", "return", "var",
 
-	"bool|", "uint|", "int|", "uintptr|"
+	"bool|", "uint|", "int|", "uintptr|",
 	"uint8|", "uint16|", "uint32|", "uint64|",
 	"int8|", "int16|", "int32|", "int64|",
 	"float32|", "float64|",
@@ -78,6 +67,7 @@ char *Go_HL_keywords[] = {
 };
 
 char *Java_HL_extensions[] = { ".java", NULL };
+char *Java_HL_long_strings[] = { "\"\"\"", NULL }; // text blocks
 char *Java_HL_keywords[] = {
 	"abstract", "assert", "break", "case", "catch",
 	"class", "const", "continue", "default", "do", "else",
@@ -85,13 +75,14 @@ char *Java_HL_keywords[] = {
 	"if", "implements", "import", "instanceof", "interface",
 	"native", "new", "package", "private", "protected", "public",
 	"return", "static", "strictfp", "super", "switch", "synchronized",
-	"this", "throw", "throws", "transient", "try", "volatile", "while"
+	"this", "throw", "throws", "transient", "try", "volatile", "while",
 
 	"boolean|", "byte|", "char|", "double|", "float|", "int|",
 	"long|", "short|", "void|", NULL
 };
 
 char *Python_HL_extensions[] = { ".py", NULL };
+char *Python_HL_long_strings[] = { "\"\"\"", "\'\'\'", NULL };
 char *Python_HL_keywords[] = {
 	"False", "None", "True", "and", "as", "assert",
 	"async", "await", "break", "class", "continue",
@@ -101,7 +92,7 @@ char *Python_HL_keywords[] = {
 	"return", "try", "while", "with", "yield", NULL
 };
 
-// A collection of filetypes with builtin syntax highlighting
+// A collection of filetypes with builtin syntax highlighting, syntax files can add more or replace them
 struct editorSyntax HLDB[] = {
 	{
 		"c",
@@ -109,7 +100,9 @@ struct editorSyntax HLDB[] = {
 		C_HL_keywords,
 		"//", "/*", "*/",
 		"#",
-		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+		NULL, NULL,
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+		{ 0 }
 	},
 	{
 		"c++",
@@ -117,7 +110,9 @@ struct editorSyntax HLDB[] = {
 		Cpp_HL_keywords,
 		"//", "/*", "*/",
 		"#",
-		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+		NULL, NULL,
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS | HL_DELIMITED_STRINGS,
+		{ 0 }
 	},
 	{
 		"go",
@@ -125,7 +120,9 @@ struct editorSyntax HLDB[] = {
 		Go_HL_keywords,
 		"//", "/*", "*/",
 		NULL,
-		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+		NULL, Go_HL_raw_strings,
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+		{ 0 }
 	},
 	{
 		"java",
@@ -133,15 +130,19 @@ struct editorSyntax HLDB[] = {
 		Java_HL_keywords,
 		"//", "/*", "*/",
 		"@",
-		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+		Java_HL_long_strings, NULL,
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+		{ 0 }
 	},
 	{
 		"python",
 		Python_HL_extensions,
 		Python_HL_keywords,
-		"#", "\'\'\'", "\'\'\'",
+		"#", NULL, NULL,
 		"@",
-		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+		Python_HL_long_strings, NULL,
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+		{ 0 }
 	}
 };
 
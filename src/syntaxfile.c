@@ -0,0 +1,288 @@
+#include "syntaxfile.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYNTAXFILE_SUFFIX ".syntax"
+#define SYNTAXFILE_SEPARATORS " \t\r\n"
+#define SYNTAX_SEPARATORS ",.()+-/*=~%<>[];" // besides whitespace and NUL
+
+// Syntax file holds definitions made of lines with a key followed by its values, a definition starts
+// with its filetype:
+//
+//   # comment
+//   filetype   ini
+//   extensions .ini .conf
+//   files      config
+//   keywords   true false
+//   types      int string
+//   comment    ;
+//   multiline  /* */
+//   custom     [
+//   longstrings """ '''
+//   rawstrings `
+//   highlight  numbers strings nested delimited
+//
+// Extensions and files are matched like filematch of builtin syntaxes, types are highlighted as
+// secondary keywords. Long and raw strings can span rows, backslashes escape only in long ones.
+// Nested highlights nested multiline comments and delimited highlights raw strings like R"xy(...)xy".
+
+// Appends a copy of the string to a NULL terminated array
+static void syntaxFilePush(char ***list, const char *s) {
+	int n = 0;
+	while (*list && (*list)[n]) n++;
+	*list = realloc(*list, sizeof(char *) * (n + 2));
+	(*list)[n] = strdup(s);
+	(*list)[n + 1] = NULL;
+}
+
+static void syntaxFileFree(struct editorSyntax *s) {
+	for (int j = 0; s->filematch && s->filematch[j]; j++) free(s->filematch[j]);
+	for (int j = 0; s->keywords && s->keywords[j]; j++) free(s->keywords[j]);
+	for (int j = 0; s->long_strings && s->long_strings[j]; j++) free(s->long_strings[j]);
+	for (int j = 0; s->raw_strings && s->raw_strings[j]; j++) free(s->raw_strings[j]);
+	free(s->long_strings);
+	free(s->raw_strings);
+	free(s->filetype);
+	free(s->filematch);
+	free(s->keywords);
+	free(s->singleline_comment_start);
+	free(s->multiline_comment_start);
+	free(s->multiline_comment_end);
+	free(s->custom_line_start);
+}
+
+// Adds the syntax to the database, replacing a syntax of the same filetype
+static void syntaxFileAdd(struct editorSyntax **db, int *n, struct editorSyntax *s) {
+	if (s->filematch == NULL) syntaxFilePush(&s->filematch, s->filetype); // a filetype always matches something
+	if (s->keywords == NULL) s->keywords = calloc(1, sizeof(char *));
+	for (int j = 0; j < *n; j++) {
+		if (!strcmp((*db)[j].filetype, s->filetype)) {
+			(*db)[j] = *s; // replaced syntax may be a builtin one, so it isn't freed
+			return;
+		}
+	}
+	*db = realloc(*db, sizeof(struct editorSyntax) * (*n + 1));
+	(*db)[(*n)++] = *s;
+}
+
+// Sets a single-valued delimiter, fails if there isn't exactly one value
+static int syntaxFileValue(char **field, char **values, int nvalues) {
+	if (nvalues != 1) return -1;
+	free(*field);
+	*field = strdup(values[0]);
+	return 0;
+}
+
+// Loads syntax definitions of the file into the database, on error the message is stored in err and
+// none of the file's definitions are added
+int syntaxFileLoad(const char *path, struct editorSyntax **db, int *n, char *err, size_t errlen) {
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		snprintf(err, errlen, "Can't read syntax file %s", path);
+		return -1;
+	}
+
+	struct editorSyntax *defs = NULL;
+	int ndefs = 0;
+	char *line = NULL;
+	size_t linecap = 0;
+	int lineno = 0;
+	const char *problem = NULL;
+	while (!problem && getline(&line, &linecap, fp) != -1) {
+		lineno++;
+		char *values[64];
+		int nvalues = 0;
+		char *save;
+		char *key = strtok_r(line, SYNTAXFILE_SEPARATORS, &save);
+		if (key == NULL || key[0] == '#') continue;
+		char *v;
+		while (nvalues < 64 && (v = strtok_r(NULL, SYNTAXFILE_SEPARATORS, &save)) != NULL) values[nvalues++] = v;
+		if (nvalues == 64) {
+			problem = "too many values";
+			break;
+		}
+
+		if (!strcmp(key, "filetype")) {
+			if (nvalues != 1) {
+				problem = "filetype needs a name";
+				break;
+			}
+			defs = realloc(defs, sizeof(struct editorSyntax) * (ndefs + 1));
+			memset(&defs[ndefs], 0, sizeof(struct editorSyntax));
+			defs[ndefs++].filetype = strdup(values[0]);
+			continue;
+		}
+		if (ndefs == 0) {
+			problem = "definition has to start with filetype";
+			break;
+		}
+
+		struct editorSyntax *s = &defs[ndefs - 1];
+		if (!strcmp(key, "extensions")) {
+			for (int j = 0; j < nvalues && !problem; j++) {
+				if (values[j][0] != '.') problem = "extension has to start with a dot";
+				else syntaxFilePush(&s->filematch, values[j]);
+			}
+		} else if (!strcmp(key, "files")) {
+			for (int j = 0; j < nvalues && !problem; j++) {
+				if (values[j][0] == '.') problem = "file name can't start with a dot, it would be an extension";
+				else syntaxFilePush(&s->filematch, values[j]);
+			}
+		} else if (!strcmp(key, "keywords") || !strcmp(key, "types")) {
+			for (int j = 0; j < nvalues && !problem; j++) {
+				size_t len = strlen(values[j]);
+				if (values[j][len - 1] == '|') {
+					problem = "keyword can't end with |";
+				} else if (key[0] == 't') {
+					char *kw2 = malloc(len + 2);
+					snprintf(kw2, len + 2, "%s|", values[j]);
+					syntaxFilePush(&s->keywords, kw2);
+					free(kw2);
+				} else {
+					syntaxFilePush(&s->keywords, values[j]);
+				}
+			}
+		} else if (!strcmp(key, "comment")) {
+			if (syntaxFileValue(&s->singleline_comment_start, values, nvalues) == -1) problem = "comment needs one delimiter";
+		} else if (!strcmp(key, "custom")) {
+			if (syntaxFileValue(&s->custom_line_start, values, nvalues) == -1) problem = "custom needs one delimiter";
+		} else if (!strcmp(key, "multiline")) {
+			if (nvalues != 2) {
+				problem = "multiline needs start and end delimiters";
+			} else {
+				syntaxFileValue(&s->multiline_comment_start, values, 1);
+				syntaxFileValue(&s->multiline_comment_end, values + 1, 1);
+			}
+		} else if (!strcmp(key, "longstrings") || !strcmp(key, "rawstrings")) {
+			for (int j = 0; j < nvalues; j++) syntaxFilePush(key[0] == 'l' ? &s->long_strings : &s->raw_strings, values[j]);
+		} else if (!strcmp(key, "highlight")) {
+			for (int j = 0; j < nvalues && !problem; j++) {
+				if (!strcmp(values[j], "numbers")) s->flags |= HL_HIGHLIGHT_NUMBERS;
+				else if (!strcmp(values[j], "strings")) s->flags |= HL_HIGHLIGHT_STRINGS;
+				else if (!strcmp(values[j], "nested")) s->flags |= HL_NESTED_COMMENTS;
+				else if (!strcmp(values[j], "delimited")) s->flags |= HL_DELIMITED_STRINGS;
+				else problem = "only numbers, strings, nested and delimited can be highlighted";
+			}
+		} else {
+			problem = "unknown key";
+		}
+	}
+	free(line);
+	fclose(fp);
+
+	if (problem) {
+		snprintf(err, errlen, "%s:%d: %s", path, lineno, problem);
+		for (int j = 0; j < ndefs; j++) syntaxFileFree(&defs[j]);
+		free(defs);
+		return -1;
+	}
+	for (int j = 0; j < ndefs; j++) syntaxFileAdd(db, n, &defs[j]);
+	free(defs);
+	return 0;
+}
+
+static int syntaxFileFilter(const struct dirent *entry) {
+	size_t len = strlen(entry->d_name);
+	size_t slen = strlen(SYNTAXFILE_SUFFIX);
+	return entry->d_name[0] != '.' && len > slen && !strcmp(entry->d_name + len - slen, SYNTAXFILE_SUFFIX);
+}
+
+// Loads all syntax files of the directory in alphabetical order, a broken file doesn't stop the rest
+// from being loaded but the first error is kept in err
+int syntaxFileLoadDir(const char *dir, struct editorSyntax **db, int *n, char *err, size_t errlen) {
+	struct dirent **entries;
+	int nentries = scandir(dir, &entries, syntaxFileFilter, alphasort);
+	if (nentries == -1) return 0; // there are no syntax files
+
+	int ret = 0;
+	for (int j = 0; j < nentries; j++) {
+		char path[4096];
+		char fileerr[256];
+		snprintf(path, sizeof(path), "%s/%s", dir, entries[j]->d_name);
+		if (syntaxFileLoad(path, db, n, fileerr, sizeof(fileerr)) == -1 && ret == 0) {
+			snprintf(err, errlen, "%s", fileerr);
+			ret = -1;
+		}
+		free(entries[j]);
+	}
+	free(entries);
+	return ret;
+}
+
+// Directory with syntax files of the user
+char *syntaxFileDir() {
+	char dir[4096];
+	const char *xdg = getenv("XDG_CONFIG_HOME");
+	const char *home = getenv("HOME");
+	if (xdg && xdg[0]) snprintf(dir, sizeof(dir), "%s/hecto/syntax", xdg);
+	else if (home && home[0]) snprintf(dir, sizeof(dir), "%s/.config/hecto/syntax", home);
+	else return NULL;
+	return strdup(dir);
+}
+
+// Builds the character class table and keyword buckets, and precomputes lengths of keywords and
+// delimiters
+void syntaxFileCompile(struct editorSyntax *s) {
+	struct syntaxCompiled *c = &s->compiled;
+	int n = 0;
+	while (s->keywords[n]) n++;
+	c->keyword_len = malloc(sizeof(int) * (n + 1));
+	c->keyword_kw2 = malloc(n + 1);
+	c->keyword_order = malloc(sizeof(int) * (n + 1));
+	for (int j = 0; j < n; j++) {
+		int len = strlen(s->keywords[j]);
+		c->keyword_kw2[j] = s->keywords[j][len - 1] == '|';
+		c->keyword_len[j] = len - c->keyword_kw2[j];
+	}
+
+	// counting sort by the first character keeps keywords starting alike in their order
+	memset(c->keyword_first, 0, sizeof(c->keyword_first));
+	for (int j = 0; j < n; j++)
+		if (c->keyword_len[j] > 0) c->keyword_first[(unsigned char)s->keywords[j][0] + 1]++;
+	for (int ch = 0; ch < 256; ch++) c->keyword_first[ch + 1] += c->keyword_first[ch];
+	int next[256];
+	memcpy(next, c->keyword_first, sizeof(next));
+	for (int j = 0; j < n; j++)
+		if (c->keyword_len[j] > 0) c->keyword_order[next[(unsigned char)s->keywords[j][0]]++] = j;
+
+	c->scs_len = s->singleline_comment_start ? strlen(s->singleline_comment_start) : 0;
+	c->mcs_len = s->multiline_comment_start ? strlen(s->multiline_comment_start) : 0;
+	c->mce_len = s->multiline_comment_end ? strlen(s->multiline_comment_end) : 0;
+	c->cls_len = s->custom_line_start ? strlen(s->custom_line_start) : 0;
+
+	for (int ch = 0; ch < 256; ch++) {
+		unsigned char cls = 0;
+		if (ch == '\0' || (ch < 128 && isspace(ch)) || strchr(SYNTAX_SEPARATORS, ch)) cls |= SYNTAX_SEP;
+		if ((s->flags & HL_HIGHLIGHT_NUMBERS) && ch < 128 && isdigit(ch)) cls |= SYNTAX_DIGIT;
+		if ((s->flags & HL_HIGHLIGHT_STRINGS) && (ch == '"' || ch == '\'')) cls |= SYNTAX_QUOTE;
+		if (c->keyword_first[ch + 1] > c->keyword_first[ch]) cls |= SYNTAX_KEYWORD;
+		c->charclass[ch] = cls;
+	}
+	if (c->cls_len) c->charclass[(unsigned char)s->custom_line_start[0]] |= SYNTAX_DELIM;
+	if (c->scs_len) c->charclass[(unsigned char)s->singleline_comment_start[0]] |= SYNTAX_DELIM;
+	if (c->mcs_len && c->mce_len) c->charclass[(unsigned char)s->multiline_comment_start[0]] |= SYNTAX_DELIM;
+
+	// long strings are found through their first character like comments, they're highlighted as strings
+	c->nlongs = 0;
+	c->longs = NULL;
+	c->long_len = NULL;
+	c->long_raw = NULL;
+	for (int raw = 0; raw < 2 && (s->flags & HL_HIGHLIGHT_STRINGS); raw++) {
+		char **list = raw ? s->raw_strings : s->long_strings;
+		for (int j = 0; list && list[j] && c->nlongs < 256; j++) {
+			c->longs = realloc(c->longs, sizeof(char *) * (c->nlongs + 1));
+			c->long_len = realloc(c->long_len, sizeof(int) * (c->nlongs + 1));
+			c->long_raw = realloc(c->long_raw, c->nlongs + 1);
+			c->longs[c->nlongs] = list[j];
+			c->long_len[c->nlongs] = strlen(list[j]);
+			c->long_raw[c->nlongs] = raw;
+			c->charclass[(unsigned char)list[j][0]] |= SYNTAX_DELIM;
+			c->nlongs++;
+		}
+	}
+	if ((s->flags & HL_HIGHLIGHT_STRINGS) && (s->flags & HL_DELIMITED_STRINGS)) c->charclass['R'] |= SYNTAX_DELIM;
+}
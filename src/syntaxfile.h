@@ -0,0 +1,52 @@
+#ifndef _HECTO_SYNTAXFILE_H_
+#define _HECTO_SYNTAXFILE_H_
+
+#include <stddef.h>
+
+#define HL_HIGHLIGHT_NUMBERS (1<<0)
+#define HL_HIGHLIGHT_STRINGS (1<<1)
+#define HL_NESTED_COMMENTS (1<<2) // multiline comments can be nested
+#define HL_DELIMITED_STRINGS (1<<3) // raw strings like R"xy(...)xy"
+
+// Classes of characters, the lexer only takes a closer look at characters of some class
+#define SYNTAX_SEP (1<<0) // separates words
+#define SYNTAX_DIGIT (1<<1) // part of a number
+#define SYNTAX_QUOTE (1<<2) // starts a string
+#define SYNTAX_DELIM (1<<3) // first character of a comment, custom line or long string delimiter
+#define SYNTAX_KEYWORD (1<<4) // first character of a keyword
+
+// What the lexer would otherwise find out about the syntax at every position it looks at
+struct syntaxCompiled {
+	int *keyword_len; // length of each keyword without the '|' marking secondary keywords
+	char *keyword_kw2; // whether each keyword is a secondary one
+	int *keyword_order; // keywords ordered by their first character, otherwise in the order they were given
+	int keyword_first[257]; // keywords starting with c are keyword_order[keyword_first[c]] until keyword_first[c + 1]
+	int scs_len, mcs_len, mce_len, cls_len; // lengths of comment and custom line delimiters
+	char **longs; // long_strings followed by raw_strings
+	int *long_len;
+	char *long_raw; // whether escapes are ignored in each of longs
+	int nlongs;
+	unsigned char charclass[256]; // classes of every character
+};
+
+struct editorSyntax {
+	char *filetype;
+	char **filematch;
+	char **keywords;
+	char *singleline_comment_start;
+	char *multiline_comment_start;
+	char *multiline_comment_end;
+	char *custom_line_start;
+	char **long_strings; // delimiters of strings which can span rows and are closed by the same delimiter
+	char **raw_strings; // like long_strings, but backslashes don't escape anything in them
+	int flags;
+
+	struct syntaxCompiled compiled; // filled in by syntaxFileCompile
+};
+
+char *syntaxFileDir();
+int syntaxFileLoad(const char *path, struct editorSyntax **db, int *n, char *err, size_t errlen);
+int syntaxFileLoadDir(const char *dir, struct editorSyntax **db, int *n, char *err, size_t errlen);
+void syntaxFileCompile(struct editorSyntax *s);
+
+#endif
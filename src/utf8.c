@@ -0,0 +1,158 @@
+#include "utf8.h"
+#include "widths.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UTF8_NZERO (int)(sizeof(utf8_zero) / sizeof(utf8_zero[0]))
+#define UTF8_NWIDE (int)(sizeof(utf8_wide) / sizeof(utf8_wide[0]))
+
+// Widths of the Basic Multilingual Plane packed two bits per character. Blocks of 256 characters
+// with the same widths are stored once -- most of them are all ones, so it takes a few kilobytes.
+static unsigned char utf8_block[256]; // block of widths of every 256 characters
+static unsigned char (*utf8_blocks)[64];
+static pthread_once_t utf8_ready = PTHREAD_ONCE_INIT; // loading threads may be the first to need the widths
+
+static int utf8Search(const struct utf8Range *r, int n, unsigned int cp) {
+	int lo = 0, hi = n - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (cp > r[mid].last) lo = mid + 1;
+		else if (cp < r[mid].first) hi = mid - 1;
+		else return 1;
+	}
+	return 0;
+}
+
+// Sets widths of the ranges in blocks of packed widths
+static void utf8Fill(unsigned char (*packed)[64], const struct utf8Range *r, int n, int width) {
+	for (int k = 0; k < n && r[k].first < 0x10000; k++) {
+		unsigned int last = r[k].last < 0x10000 ? r[k].last : 0xffff;
+		for (unsigned int cp = r[k].first; cp <= last; cp++) {
+			unsigned char *byte = &packed[cp >> 8][(cp & 0xff) >> 2];
+			int shift = (cp & 3) * 2;
+			*byte = (*byte & ~(3 << shift)) | (width << shift);
+		}
+	}
+}
+
+static void utf8Init() {
+	unsigned char (*packed)[64] = malloc(256 * 64);
+	memset(packed, 0x55, 256 * 64); // all ones
+	utf8Fill(packed, utf8_wide, UTF8_NWIDE, 2);
+	utf8Fill(packed, utf8_zero, UTF8_NZERO, 0);
+
+	int nblocks = 0;
+	for (int b = 0; b < 256; b++) {
+		int k = 0;
+		while (k < nblocks && memcmp(packed[k], packed[b], 64)) k++;
+		if (k == nblocks) memmove(packed[nblocks++], packed[b], 64);
+		utf8_block[b] = k;
+	}
+	utf8_blocks = realloc(packed, nblocks * 64);
+}
+
+// Decodes the character at the start of s, returns its length or 0 if it isn't valid UTF-8
+int utf8Decode(const char *s, int len, unsigned int *cp) {
+	const unsigned char *u = (const unsigned char *)s;
+	if (len < 1) return 0;
+	if (u[0] < 0x80) {
+		*cp = u[0];
+		return 1;
+	}
+
+	int n;
+	unsigned int c, min;
+	if ((u[0] & 0xe0) == 0xc0) {
+		n = 2;
+		c = u[0] & 0x1f;
+		min = 0x80;
+	} else if ((u[0] & 0xf0) == 0xe0) {
+		n = 3;
+		c = u[0] & 0x0f;
+		min = 0x800;
+	} else if ((u[0] & 0xf8) == 0xf0) {
+		n = 4;
+		c = u[0] & 0x07;
+		min = 0x10000;
+	} else {
+		return 0;
+	}
+	if (len < n) return 0;
+	for (int i = 1; i < n; i++) {
+		if ((u[i] & 0xc0) != 0x80) return 0;
+		c = (c << 6) | (u[i] & 0x3f);
+	}
+	if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) return 0; // overlong or not a character
+	*cp = c;
+	return n;
+}
+
+// Number of columns the character takes on screen: 0 for combining ones, 2 for East Asian wide ones
+int utf8Width(unsigned int cp) {
+	if (cp < 0x300) return 1;
+	if (cp < 0x10000) {
+		pthread_once(&utf8_ready, utf8Init);
+		return (utf8_blocks[utf8_block[cp >> 8]][(cp & 0xff) >> 2] >> ((cp & 3) * 2)) & 3;
+	}
+	if (utf8Search(utf8_zero, UTF8_NZERO, cp)) return 0;
+	if (utf8Search(utf8_wide, UTF8_NWIDE, cp)) return 2;
+	return 1;
+}
+
+// Width of the character at the start of s, invalid bytes take one column each
+int utf8CharWidth(const char *s, int len, int *bytes) {
+	unsigned int cp;
+	int n = utf8Decode(s, len, &cp);
+	if (n == 0) {
+		*bytes = 1;
+		return 1;
+	}
+	*bytes = n;
+	return utf8Width(cp);
+}
+
+// Whether there are only ASCII characters in s, checked 8 bytes at a time
+int utf8IsAscii(const char *s, int len) {
+	uint64_t acc = 0;
+	int i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t x;
+		memcpy(&x, &s[i], 8);
+		acc |= x;
+	}
+	for (; i < len; i++) acc |= (unsigned char)s[i];
+	return (acc & 0x8080808080808080ULL) == 0;
+}
+
+// Position of the character following the one at position at
+int utf8Next(const char *s, int at, int len) {
+	unsigned int cp;
+	int n = utf8Decode(&s[at], len - at, &cp);
+	return at + (n ? n : 1);
+}
+
+// Position of the character preceding position at
+int utf8Prev(const char *s, int at) {
+	unsigned int cp;
+	for (int k = 1; k <= 4 && k <= at; k++) {
+		if (((unsigned char)s[at - k] & 0xc0) == 0x80) continue;
+		if (utf8Decode(&s[at - k], k, &cp) == k) return at - k;
+		break;
+	}
+	return at - 1;
+}
+
+// Skips the rest of a character which started before position at
+int utf8Skip(const char *s, int at, int len) {
+	unsigned int cp;
+	if (at >= len || ((unsigned char)s[at] & 0xc0) != 0x80) return at;
+	for (int k = 1; k <= 3 && k <= at; k++) {
+		int n = utf8Decode(&s[at - k], len - (at - k), &cp);
+		if (n > k) return at - k + n;
+		if (((unsigned char)s[at - k] & 0xc0) != 0x80) break;
+	}
+	return at;
+}
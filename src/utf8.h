@@ -0,0 +1,12 @@
+#ifndef _HECTO_UTF8_H_
+#define _HECTO_UTF8_H_
+
+int utf8Decode(const char *s, int len, unsigned int *cp);
+int utf8Width(unsigned int cp);
+int utf8CharWidth(const char *s, int len, int *bytes);
+int utf8IsAscii(const char *s, int len);
+int utf8Next(const char *s, int at, int len);
+int utf8Prev(const char *s, int at);
+int utf8Skip(const char *s, int at, int len);
+
+#endif